@@ -1,8 +1,13 @@
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 
+#ifdef __GLIBC__
+#   include <malloc.h>
+#endif
+
 #include "ta.h"
 
 #ifndef __ta_inline
@@ -13,6 +18,30 @@
 #   endif
 #endif
 
+#ifndef __ta_prefetch
+#   if __ta_has_builtin(__builtin_prefetch)
+#       define __ta_prefetch(x) __builtin_prefetch(x)
+#   else
+#       define __ta_prefetch(x) ((void)(x))
+#   endif
+#endif
+
+#ifndef __ta_assume_aligned
+#   if __ta_has_builtin(__builtin_assume_aligned)
+#       define __ta_assume_aligned(x, n) __builtin_assume_aligned(x, n)
+#   else
+#       define __ta_assume_aligned(x, n) (x)
+#   endif
+#endif
+
+#ifndef __ta_thread_local
+#   if defined(_MSC_VER) && !defined(__clang__)
+#       define __ta_thread_local __declspec(thread)
+#   else
+#       define __ta_thread_local _Thread_local
+#   endif
+#endif
+
 #ifndef TA_MAGIC
 #   if defined(__OPTIMIZE__) || defined(NDEBUG)
 #       define TA_MAGIC 0
@@ -21,320 +50,3295 @@
 #   endif
 #endif
 
+// Compact header layout: the destructor is kept out of line in a shared table
+// and its presence is tracked by a flag bit of `size`, which on 64-bit targets
+// also holds the number of children. Siblings are linked forward only.
+#ifndef TA_COMPACT
+#   define TA_COMPACT 0
+#endif
+
+// Out-of-line metadata: headers are packed into dedicated slabs, payloads come
+// straight from `malloc()` and are mapped back to their headers by address, so
+// tree operations never touch the cache lines or pages holding user data.
+#ifndef TA_OUTLINE
+#   define TA_OUTLINE 0
+#endif
+
+// Child arrays: once a parent has more than `TA_ARRAY_MIN` children, they are
+// also indexed by a contiguous array, so walks over them can prefetch ahead.
+#ifndef TA_CHILD_ARRAY
+#   define TA_CHILD_ARRAY 0
+#endif
+
+// Ancestry index: every chunk knows its depth and has a jump pointer to one of
+// its ancestors, chosen so that any ancestor is reached in O(log depth) steps.
+// Reparenting a chunk relabels its whole subtree.
+#ifndef TA_ANCESTRY
+#   define TA_ANCESTRY 0
+#endif
+
+// Named chunks: once a parent with names among its children has at least
+// `TA_NAMES_MIN` of them, ta_find_child() builds a hash index over the names.
+#ifndef TA_NAMES
+#   define TA_NAMES 0
+#endif
+
+// Header profiles: without destructor support chunks have no destructor slot
+// and every subtree is freed as a plain one; without back links siblings are
+// linked forward only, so unlinking a chunk that is not the first child and
+// stepping backwards have to walk the list from the first child.
+#ifndef TA_DESTRUCTORS
+#   define TA_DESTRUCTORS 1
+#endif
+
+#ifndef TA_BACKLINKS
+#   define TA_BACKLINKS !TA_COMPACT
+#endif
+
+// Slabs: small blocks of the default allocator come from size classes carved out
+// of larger pages and are recycled through free lists of their class instead of
+// going through `malloc()` one by one.
+#ifndef TA_SLAB
+#   define TA_SLAB 0
+#endif
+
+// Chunk cache: every thread keeps a bounded number of the blocks it frees, by
+// size, and hands them out again before asking libc.
+#ifndef TA_CACHE
+#   define TA_CACHE 0
+#endif
+
+// Mapped chunks: blocks of the default allocator of at least this many bytes get
+// a mapping of their own, which grows and shrinks by moving pages, not bytes.
+#if !defined(TA_MMAP_THRESHOLD) || defined(_WIN32)
+#   undef TA_MMAP_THRESHOLD
+#   define TA_MMAP_THRESHOLD 0
+#endif
+
+#if TA_COMPACT && !TA_DESTRUCTORS
+#   error "TA_COMPACT requires TA_DESTRUCTORS"
+#endif
+
+#if TA_MMAP_THRESHOLD && TA_MMAP_THRESHOLD < 4096
+#   error "TA_MMAP_THRESHOLD must be at least 4096"
+#endif
+
+#include <stdatomic.h>
+
+#if TA_SLAB || TA_CACHE
+#   include <pthread.h>
+#endif
+
+#ifndef _WIN32
+#   include <sys/mman.h>
+#   include <unistd.h>
+#endif
+
+#if TA_CHILD_ARRAY
+#   define TA_ARRAY_MIN 32
+#   define TA_ARRAY_PREFETCH 8
+#endif
+
+#if TA_NAMES
+#   define TA_NAMES_MIN 16
+#endif
+
+// Chunk flags are kept in the top bits of `size`, which chunk sizes never reach.
+#define TA_SIZE_FLAG(n) (((size_t)PTRDIFF_MAX + 1) >> (n))
+
+// The chunk or one of its descendants may have a destructor. Once set, the flag
+// is also set on every ancestor, so a clear flag means a plain subtree.
+#if TA_DESTRUCTORS
+#   define TA_SIZE_DESTRUCTORS TA_SIZE_FLAG(0)
+#else
+#   define TA_SIZE_DESTRUCTORS ((size_t)0)
+#endif
+
+// The chunk comes from a custom allocator, which is kept in front of its block.
+#define TA_SIZE_ALLOCATOR TA_SIZE_FLAG(2)
+
+// The chunk is placed past padding in its block to align it, see `struct ta_align`.
+#define TA_SIZE_ALIGNED TA_SIZE_FLAG(3)
+
+// The chunk ends the children after a mark, which the mark table keeps, see `ta_mark()`.
+// A chunk that leaves its parent passes its mark on to the next sibling.
+#define TA_SIZE_MARKED TA_SIZE_FLAG(4)
+
+// Compact headers of 64-bit targets keep the number of children below the flags,
+// which leaves 43 bits, 8 TiB, for the size. A count that reaches `TA_COUNT_MAX`
+// sticks there and the children are counted when the exact number is needed.
+#if TA_COMPACT && SIZE_MAX > UINT32_MAX
+#   define TA_COUNT_BITS 16
+#   define TA_COUNT_SHIFT 43
+#   define TA_COUNT_MAX (((size_t)1 << TA_COUNT_BITS) - 1)
+#   define TA_SIZE_COUNT (TA_COUNT_MAX << TA_COUNT_SHIFT)
+#else
+#   define TA_COUNT_BITS 0
+#   define TA_SIZE_COUNT ((size_t)0)
+#endif
+
+#if TA_COMPACT
+#   define TA_SIZE_DESTRUCTOR TA_SIZE_FLAG(1)
+#   define TA_SIZE_FLAGS (TA_SIZE_DESTRUCTORS | TA_SIZE_DESTRUCTOR | TA_SIZE_ALLOCATOR | \
+                          TA_SIZE_ALIGNED | TA_SIZE_MARKED | TA_SIZE_COUNT)
+#else
+#   define TA_SIZE_FLAGS (TA_SIZE_DESTRUCTORS | TA_SIZE_ALLOCATOR | TA_SIZE_ALIGNED | \
+                          TA_SIZE_MARKED)
+#endif
+
 struct ta_header {
 #if TA_MAGIC
     uintptr_t magic;
 #endif
+    struct ta_header *parent;
     struct ta_header *list;
-    struct ta_header *prev;
+#if TA_BACKLINKS
+    struct ta_header *prev; // the first child links to the last one
+#endif
     struct ta_header *next;
+#if TA_OUTLINE
+    void *ptr;
+#endif
     size_t size;
+#if !TA_COUNT_BITS
+    size_t count; // number of children
+#endif
+#if TA_DESTRUCTORS && !TA_COMPACT
     ta_destructor destructor;
+#endif
+#if TA_CHILD_ARRAY
+    struct ta_array *array;
+    size_t index; // position in the child array of the parent
+#endif
+#if TA_ANCESTRY
+    struct ta_header *jump; // roots jump to themselves
+    size_t depth;
+#endif
+#if TA_NAMES
+    char *name;
+    struct ta_names *names; // index of named children
+#endif
+};
+
+#if TA_CHILD_ARRAY
+// Children of a wide parent from the last one to the first one. Unlinked
+// children leave holes, which are squeezed out once there are too many.
+struct ta_array {
+    size_t begin;
+    size_t end;
+    size_t holes;
+    size_t capacity;
+    size_t *rank; // Fenwick tree of the occupied slots, see `ta_array_rank_build()`
+    struct ta_header *items[];
+};
+#endif
+
+#if TA_NAMES
+struct ta_names_entry {
+    size_t hash;
+    struct ta_header *header;
 };
 
-#define TA_HDR_SIZE sizeof(struct ta_header)
-#define TA_MAX_SIZE ((size_t)PTRDIFF_MAX - TA_HDR_SIZE)
+// Named children hashed with linear probing, an empty slot has no header.
+struct ta_names {
+    size_t count;
+    size_t mask;
+    struct ta_names_entry entries[];
+};
+#endif
 
-#define TA_HDR_FROM_PTR(ptr) ((struct ta_header *)((uint8_t *)(ptr) - TA_HDR_SIZE))
-#define TA_PTR_FROM_HDR(hdr) ((void *)((uint8_t *)(hdr) + TA_HDR_SIZE))
+#if TA_OUTLINE
+#   define TA_HDR_SIZE 0
+#   define TA_HDR_SLAB 64
+#else
+#   define TA_HDR_SIZE sizeof(struct ta_header)
+#   define TA_HDR_FROM_PTR(ptr) ((struct ta_header *)((uint8_t *)(ptr) - TA_HDR_SIZE))
+#   define TA_PTR_FROM_HDR(hdr) ((void *)((uint8_t *)(hdr) + TA_HDR_SIZE))
+#endif
 
-static __ta_inline __ta_nodiscard __ta_returns_nonnull
-struct ta_header *ta_header_from_ptr(const void *ptr)
+#define TA_MAX_SIZE (~TA_SIZE_FLAGS - TA_HDR_SIZE)
+
+// A block holds the header and the payload of a chunk, or only the payload with
+// out-of-line headers. Blocks from a custom allocator start with a pointer to it,
+// padded so that chunks keep the alignment they have with libc.
+#if TA_OUTLINE
+#   define TA_BLOCK_SIZE(size) ((size) ? (size) : 1)
+#else
+#   define TA_BLOCK_SIZE(size) (TA_HDR_SIZE + (size))
+#endif
+
+#define TA_BLOCK_ALIGN _Alignof(max_align_t)
+#define TA_BLOCK_PREFIX TA_BLOCK_ALIGN
+
+// An aligned chunk starts `pad` bytes into its block, and this sits right before
+// it. The block has room for the largest padding, which is `TA_ALIGN_SPAN()`
+// as blocks and headers are aligned to pointers at least.
+struct ta_align {
+    size_t align;
+    size_t pad;
+};
+
+#define TA_ALIGN_PAD sizeof(struct ta_align)
+#define TA_ALIGN_SPAN(align) ((align) ? TA_ALIGN_PAD + (align) - sizeof(void *) : 0)
+
+static __ta_inline __ta_nodiscard
+size_t ta_header_get_size(const struct ta_header *h)
+{
+    return h->size & ~TA_SIZE_FLAGS;
+}
+
+static __ta_inline
+void ta_header_set_size(struct ta_header *h, size_t size)
+{
+    h->size = (h->size & TA_SIZE_FLAGS) | size;
+}
+
+// The number of children, exact below `TA_COUNT_MAX`, which stands for at least
+// as many in compact headers. Enough to compare with the index thresholds.
+static __ta_inline __ta_nodiscard
+size_t ta_header_get_count(const struct ta_header *h)
+{
+#if TA_COUNT_BITS
+    return (h->size & TA_SIZE_COUNT) >> TA_COUNT_SHIFT;
+#else
+    return h->count;
+#endif
+}
+
+static __ta_inline
+void ta_header_add_count(struct ta_header *h, size_t n)
+{
+#if TA_COUNT_BITS
+    size_t count = ta_header_get_count(h);
+    count = n < TA_COUNT_MAX - count ? count + n : TA_COUNT_MAX;
+    h->size = (h->size & ~TA_SIZE_COUNT) | count << TA_COUNT_SHIFT;
+#else
+    h->count += n;
+#endif
+}
+
+static __ta_inline
+void ta_header_sub_count(struct ta_header *h, size_t n)
+{
+#if TA_COUNT_BITS
+    if (ta_header_get_count(h) != TA_COUNT_MAX)
+        h->size -= n << TA_COUNT_SHIFT;
+#else
+    h->count -= n;
+#endif
+}
+
+static __ta_inline
+void ta_header_clear_count(struct ta_header *h)
+{
+#if TA_COUNT_BITS
+    h->size &= ~TA_SIZE_COUNT;
+#else
+    h->count = 0;
+#endif
+}
+
+// The exact number of children, which a stuck count finds in the child array
+// or by walking the list.
+static __ta_nodiscard
+size_t ta_header_count_children(const struct ta_header *h)
+{
+    size_t count = ta_header_get_count(h);
+
+#if TA_COUNT_BITS
+    if (__ta_unlikely(count == TA_COUNT_MAX)) {
+#if TA_CHILD_ARRAY
+        const struct ta_array *a = h->array;
+        if (a)
+            return a->end - a->begin - a->holes;
+#endif
+        count = 0;
+        for (const struct ta_header *h_child = h->list; h_child; h_child = h_child->next)
+            count++;
+    }
+#endif
+
+    return count;
+}
+
+static __ta_inline
+void ta_spin_lock(atomic_int *lock)
+{
+    while (atomic_exchange_explicit(lock, 1, memory_order_acquire)) {
+        while (atomic_load_explicit(lock, memory_order_relaxed))
+            continue;
+    }
+}
+
+static __ta_inline
+void ta_spin_unlock(atomic_int *lock)
+{
+    atomic_store_explicit(lock, 0, memory_order_release);
+}
+
+#if TA_SLAB || TA_CACHE
+static void ta_thread_detach(void *unused);
+
+static _Thread_local bool ta_thread_attached;
+static pthread_once_t ta_thread_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ta_thread_key;
+
+static void ta_thread_init(void)
+{
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(pthread_key_create(&ta_thread_key, ta_thread_detach)))
+        abort();
+    // GCOVR_EXCL_STOP
+}
+
+// Makes the thread hand its cached blocks back when it exits, which any non-NULL
+// value of the key does.
+static __ta_inline
+void ta_thread_attach(void)
+{
+    if (__ta_unlikely(!ta_thread_attached)) {
+        pthread_once(&ta_thread_once, ta_thread_init);
+        pthread_setspecific(ta_thread_key, &ta_thread_key);
+        ta_thread_attached = true;
+    }
+}
+#endif
+
+#if TA_SLAB
+#define TA_SLAB_MAX 256
+#define TA_SLAB_PAGE ((size_t)16 << 10)
+#define TA_SLAB_CLASSES (TA_SLAB_MAX / TA_BLOCK_ALIGN)
+#define TA_SLAB_CLASS(size) (((size) - 1) / TA_BLOCK_ALIGN)
+#define TA_SLAB_FITS(size) ((size) <= TA_SLAB_MAX)
+
+struct ta_slab_block {
+    struct ta_slab_block *next;
+};
+
+// Pages start with this and are aligned to their size, so blocks find their page.
+struct ta_slab_page {
+    struct ta_slab_page *next;
+    uint32_t size; // of its blocks
+    uint32_t free; // free blocks, only counted by ta_slab_trim()
+};
+
+#define TA_SLAB_PAGE_OF(ptr) \
+    ((struct ta_slab_page *)((uintptr_t)(ptr) & ~(uintptr_t)(TA_SLAB_PAGE - 1)))
+
+// Every thread hands out blocks of a class from its own free list first, then
+// carves them from its current page of the class, so neither takes a lock.
+struct ta_slab_class {
+    struct ta_slab_block *free;
+    uint8_t *cur;
+    uint8_t *end;
+};
+
+static _Thread_local struct ta_slab_class ta_slab[TA_SLAB_CLASSES];
+
+// Pages are kept until ta_trim_all() finds all of their blocks free. Free blocks
+// of exited threads are left here for the next thread that runs out of them.
+static struct {
+    atomic_int lock;
+    struct ta_slab_page *pages;
+    struct ta_slab_block *free[TA_SLAB_CLASSES];
+} ta_slab_depot;
+
+// Hands the free blocks of an exiting or trimming thread over to the depot.
+static void ta_slab_detach(void)
+{
+    ta_spin_lock(&ta_slab_depot.lock);
+    for (size_t i = 0; i < TA_SLAB_CLASSES; ++i) {
+        struct ta_slab_class *c = &ta_slab[i];
+        size_t size = (i + 1) * TA_BLOCK_ALIGN;
+
+        // The rest of the current page is handed over block by block.
+        for (; (size_t)(c->end - c->cur) >= size; c->cur += size) {
+            struct ta_slab_block *b = (struct ta_slab_block *)c->cur;
+            b->next = c->free;
+            c->free = b;
+        }
+
+        while (c->free) {
+            struct ta_slab_block *b = c->free;
+            c->free = b->next;
+            b->next = ta_slab_depot.free[i];
+            ta_slab_depot.free[i] = b;
+        }
+    }
+    ta_spin_unlock(&ta_slab_depot.lock);
+}
+
+// Carves a block of a class whose free list is empty, taking over the blocks
+// left by exited threads before starting a new page.
+static __ta_nodiscard
+void *ta_slab_refill(size_t i)
+{
+    struct ta_slab_class *c = &ta_slab[i];
+    size_t size = (i + 1) * TA_BLOCK_ALIGN;
+
+    ta_thread_attach();
+
+    if ((size_t)(c->end - c->cur) < size) {
+        ta_spin_lock(&ta_slab_depot.lock);
+        struct ta_slab_block *b = ta_slab_depot.free[i];
+        ta_slab_depot.free[i] = NULL;
+        ta_spin_unlock(&ta_slab_depot.lock);
+
+        if (b) {
+            c->free = b->next;
+            return b;
+        }
+
+        struct ta_slab_page *page =
+            (struct ta_slab_page *)aligned_alloc(TA_SLAB_PAGE, TA_SLAB_PAGE);
+        if (__ta_unlikely(!page))
+            return NULL;
+
+        page->size = (uint32_t)size;
+        ta_spin_lock(&ta_slab_depot.lock);
+        page->next = ta_slab_depot.pages;
+        ta_slab_depot.pages = page;
+        ta_spin_unlock(&ta_slab_depot.lock);
+
+        c->cur = (uint8_t *)page + TA_BLOCK_ALIGN;
+        c->end = (uint8_t *)page + TA_SLAB_PAGE;
+    }
+
+    void *ptr = c->cur;
+    c->cur += size;
+    return ptr;
+}
+
+static __ta_inline __ta_nodiscard
+void *ta_slab_alloc(size_t size, bool zero)
+{
+    size_t i = TA_SLAB_CLASS(size);
+    struct ta_slab_block *b = ta_slab[i].free;
+
+    if (__ta_likely(b)) {
+        ta_slab[i].free = b->next;
+    } else {
+        b = (struct ta_slab_block *)ta_slab_refill(i);
+    }
+
+    if (zero && b)
+        memset(b, 0, size);
+
+    return b;
+}
+
+// Blocks go to the free list of the thread freeing them.
+static __ta_inline
+void ta_slab_free(void *ptr, size_t size)
+{
+    struct ta_slab_class *c = &ta_slab[TA_SLAB_CLASS(size)];
+    struct ta_slab_block *b = (struct ta_slab_block *)ptr;
+
+    if (__ta_unlikely(!c->free))
+        ta_thread_attach();
+
+    b->next = c->free;
+    c->free = b;
+}
+
+// Frees the pages whose blocks are all free in the depot, once the calling thread
+// has handed its own free blocks over. Blocks on the free lists of other threads
+// keep their pages, and so does the rest of a page they carve blocks from.
+static size_t ta_slab_trim(void)
+{
+    struct ta_slab_page *released = NULL;
+    size_t bytes = 0;
+
+    ta_slab_detach();
+    ta_spin_lock(&ta_slab_depot.lock);
+
+    for (struct ta_slab_page *page = ta_slab_depot.pages; page; page = page->next)
+        page->free = 0;
+
+    for (size_t i = 0; i < TA_SLAB_CLASSES; ++i) {
+        for (struct ta_slab_block *b = ta_slab_depot.free[i]; b; b = b->next)
+            TA_SLAB_PAGE_OF(b)->free++;
+    }
+
+    // Blocks of free pages are dropped from the lists before the pages go.
+    for (size_t i = 0; i < TA_SLAB_CLASSES; ++i) {
+        size_t count = (TA_SLAB_PAGE - TA_BLOCK_ALIGN) / ((i + 1) * TA_BLOCK_ALIGN);
+        struct ta_slab_block **link = &ta_slab_depot.free[i];
+
+        while (*link) {
+            if (TA_SLAB_PAGE_OF(*link)->free == count) {
+                *link = (*link)->next;
+            } else {
+                link = &(*link)->next;
+            }
+        }
+    }
+
+    struct ta_slab_page **link = &ta_slab_depot.pages;
+    while (*link) {
+        struct ta_slab_page *page = *link;
+        if (page->free == (TA_SLAB_PAGE - TA_BLOCK_ALIGN) / page->size) {
+            *link = page->next;
+            page->next = released;
+            released = page;
+        } else {
+            link = &page->next;
+        }
+    }
+
+    ta_spin_unlock(&ta_slab_depot.lock);
+
+    while (released) {
+        struct ta_slab_page *next = released->next;
+        free(released);
+        released = next;
+        bytes += TA_SLAB_PAGE;
+    }
+
+    return bytes;
+}
+#else
+#define TA_SLAB_FITS(size) 0
+#endif
+
+#if TA_CACHE
+#define TA_CACHE_MAX 1024
+#define TA_CACHE_BIN(size) (((size) + 7) / 16)
+#define TA_CACHE_BINS (TA_CACHE_BIN(TA_CACHE_MAX) + 1)
+#define TA_CACHE_COUNT 64
+#define TA_CACHE_BYTES ((size_t)256 << 10)
+#define TA_CACHE_FITS(size) (!TA_SLAB_FITS(size) && (size) <= TA_CACHE_MAX)
+#define TA_CACHE_ROUND(size) (TA_CACHE_BIN(size) * 16 + 8)
+
+struct ta_cache_block {
+    struct ta_cache_block *next;
+};
+
+struct ta_cache_bin {
+    struct ta_cache_block *free;
+    size_t count;
+};
+
+// Freed blocks of up to `TA_CACHE_MAX` bytes that are not slab blocks are kept
+// by the thread freeing them, up to `TA_CACHE_COUNT` of each size and
+// `TA_CACHE_BYTES` in total. Their sizes are rounded up to 8 past a multiple of
+// 16, so any block of a bin fits any size of the bin, and a libc with an 8-byte
+// chunk header like glibc allocates the same chunk as for the exact size.
+static _Thread_local struct {
+    struct ta_cache_bin bins[TA_CACHE_BINS];
+    size_t bytes;
+    struct ta_cache_stats stats;
+} ta_cache;
+
+static __ta_inline __ta_nodiscard
+void *ta_cache_alloc(size_t size, bool zero)
+{
+    struct ta_cache_bin *bin = &ta_cache.bins[TA_CACHE_BIN(size)];
+    struct ta_cache_block *b = bin->free;
+
+    if (__ta_unlikely(!b)) {
+        ta_cache.stats.misses++;
+        size = TA_CACHE_ROUND(size);
+        return zero ? calloc(1, size) : malloc(size);
+    }
+
+    bin->free = b->next;
+    bin->count--;
+    ta_cache.bytes -= TA_CACHE_ROUND(size);
+    ta_cache.stats.hits++;
+
+    if (zero)
+        memset(b, 0, size);
+
+    return b;
+}
+
+static __ta_inline
+void ta_cache_free(void *ptr, size_t size)
+{
+    struct ta_cache_bin *bin = &ta_cache.bins[TA_CACHE_BIN(size)];
+    struct ta_cache_block *b = (struct ta_cache_block *)ptr;
+
+    size = TA_CACHE_ROUND(size);
+    if (__ta_unlikely(bin->count >= TA_CACHE_COUNT || ta_cache.bytes + size > TA_CACHE_BYTES)) {
+        ta_cache.stats.evictions++;
+        free(ptr);
+        return;
+    }
+
+    if (__ta_unlikely(!ta_cache.bytes))
+        ta_thread_attach();
+
+    b->next = bin->free;
+    bin->free = b;
+    bin->count++;
+    ta_cache.bytes += size;
+    ta_cache.stats.frees++;
+}
+
+static void ta_cache_flush(void)
+{
+    for (size_t i = 0; i < TA_CACHE_BINS; ++i) {
+        struct ta_cache_bin *bin = &ta_cache.bins[i];
+        while (bin->free) {
+            struct ta_cache_block *b = bin->free;
+            bin->free = b->next;
+            free(b);
+        }
+        bin->count = 0;
+    }
+
+    ta_cache.bytes = 0;
+    ta_cache.stats.flushes++;
+}
+#else
+#define TA_CACHE_FITS(size) 0
+#endif
+
+#if TA_SLAB || TA_CACHE
+static void ta_thread_detach(void *unused)
+{
+    (void)unused;
+    ta_thread_attached = false;
+#if TA_CACHE
+    ta_cache_flush();
+#endif
+#if TA_SLAB
+    ta_slab_detach();
+#endif
+}
+#endif
+
+#if TA_MMAP_THRESHOLD
+#define TA_MMAP_FITS(size) ((size) >= (size_t)TA_MMAP_THRESHOLD)
+
+static __ta_nodiscard
+size_t ta_mmap_length(size_t size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return (size + page - 1) & ~(page - 1);
+}
+
+static __ta_nodiscard
+void *ta_mmap_alloc(size_t size)
+{
+    void *ptr = mmap(NULL, ta_mmap_length(size), PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return ptr != MAP_FAILED ? ptr : NULL;
+}
+
+static void ta_mmap_free(void *ptr, size_t size)
+{
+    munmap(ptr, ta_mmap_length(size));
+}
+
+// Linux moves the page tables of a mapping that has to move, elsewhere the bytes
+// are copied to a new mapping.
+static __ta_nodiscard
+void *ta_mmap_realloc(void *ptr, size_t old_size, size_t size)
+{
+    size_t old_length = ta_mmap_length(old_size);
+    size_t length = ta_mmap_length(size);
+
+    if (length == old_length)
+        return ptr;
+
+#ifdef __linux__
+    void *new_ptr = mremap(ptr, old_length, length, MREMAP_MAYMOVE);
+    return new_ptr != MAP_FAILED ? new_ptr : NULL;
+#else
+    void *new_ptr = ta_mmap_alloc(size);
+    if (__ta_unlikely(!new_ptr))
+        return NULL;
+
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    ta_mmap_free(ptr, old_size);
+    return new_ptr;
+#endif
+}
+#else
+#define TA_MMAP_FITS(size) 0
+#endif
+
+// Blocks the cache may hold are allocated with their size rounded up.
+static __ta_inline __ta_nodiscard
+size_t ta_heap_size(size_t size)
+{
+#if TA_CACHE
+    if (TA_CACHE_FITS(size))
+        return TA_CACHE_ROUND(size);
+#endif
+    return size;
+}
+
+// The default allocator of blocks: libc, with slabs and the cache in front of it.
+static __ta_inline __ta_nodiscard
+void *ta_heap_alloc(size_t size, bool zero)
+{
+#if TA_SLAB
+    if (__ta_likely(TA_SLAB_FITS(size)))
+        return __ta_assume_aligned(ta_slab_alloc(size, zero), TA_BLOCK_ALIGN);
+#endif
+#if TA_CACHE
+    if (__ta_likely(TA_CACHE_FITS(size)))
+        return __ta_assume_aligned(ta_cache_alloc(size, zero), TA_BLOCK_ALIGN);
+#endif
+#if TA_MMAP_THRESHOLD
+    // Fresh mappings are zeroed already.
+    if (__ta_unlikely(TA_MMAP_FITS(size)))
+        return ta_mmap_alloc(size);
+#endif
+    return zero ? calloc(1, size) : malloc(size);
+}
+
+static __ta_inline
+void ta_heap_free(void *ptr, size_t size)
+{
+#if TA_SLAB
+    if (__ta_likely(TA_SLAB_FITS(size))) {
+        ta_slab_free(ptr, size);
+        return;
+    }
+#endif
+#if TA_CACHE
+    if (__ta_likely(TA_CACHE_FITS(size))) {
+        ta_cache_free(ptr, size);
+        return;
+    }
+#endif
+#if TA_MMAP_THRESHOLD
+    if (__ta_unlikely(TA_MMAP_FITS(size))) {
+        ta_mmap_free(ptr, size);
+        return;
+    }
+#endif
+    (void)size;
+    free(ptr);
+}
+
+static __ta_nodiscard
+void *ta_heap_realloc(void *ptr, size_t old_size, size_t size)
+{
+#if TA_SLAB
+    if (TA_SLAB_FITS(old_size) || TA_SLAB_FITS(size)) {
+        if (TA_SLAB_FITS(old_size) && TA_SLAB_FITS(size) &&
+            TA_SLAB_CLASS(old_size) == TA_SLAB_CLASS(size))
+            return ptr;
+
+        void *new_ptr = ta_heap_alloc(size, false);
+        if (__ta_unlikely(!new_ptr))
+            return NULL;
+
+        memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+        ta_heap_free(ptr, old_size);
+        return new_ptr;
+    }
+#endif
+#if TA_MMAP_THRESHOLD
+    if (TA_MMAP_FITS(old_size) && TA_MMAP_FITS(size))
+        return ta_mmap_realloc(ptr, old_size, size);
+
+    // Blocks crossing the threshold move between libc and a mapping.
+    if (TA_MMAP_FITS(old_size) || TA_MMAP_FITS(size)) {
+        void *new_ptr = ta_heap_alloc(size, false);
+        if (__ta_unlikely(!new_ptr))
+            return NULL;
+
+        memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+        ta_heap_free(ptr, old_size);
+        return new_ptr;
+    }
+#endif
+    (void)old_size;
+    return realloc(ptr, ta_heap_size(size));
+}
+
+// Allocates a block from a custom allocator and stores the allocator in front.
+static __ta_nodiscard
+void *ta_block_alloc_from(const struct ta_allocator *allocator, size_t size, bool zero)
+{
+    void *ptr;
+
+    size += TA_BLOCK_PREFIX;
+    if (zero && allocator->zalloc) {
+        ptr = allocator->zalloc(allocator->ctx, size);
+    } else {
+        ptr = allocator->alloc(allocator->ctx, size);
+        if (zero && ptr)
+            memset(ptr, 0, size);
+    }
+
+    if (__ta_unlikely(!ptr))
+        return NULL;
+
+    memcpy(ptr, &allocator, sizeof(allocator));
+    return (uint8_t *)ptr + TA_BLOCK_PREFIX;
+}
+
+// Allocates a block of `size` bytes from `allocator`, or from libc if it is NULL.
+static __ta_inline __ta_nodiscard __ta_returns_nonnull
+void *ta_block_alloc(const struct ta_allocator *allocator, size_t size, bool zero)
+{
+    void *ptr;
+
+    if (__ta_likely(!allocator)) {
+        ptr = ta_heap_alloc(size, zero);
+    } else {
+        // Lets the compiler initialize headers the same way on both paths.
+        ptr = __ta_assume_aligned(ta_block_alloc_from(allocator, size, zero),
+                                  TA_BLOCK_ALIGN);
+    }
+
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(!ptr))
+        abort();
+    // GCOVR_EXCL_STOP
+
+    return ptr;
+}
+
+// Moves a block to `allocator`, which may be another one than `old` it came from.
+static __ta_nodiscard __ta_returns_nonnull
+void *ta_block_realloc(const struct ta_allocator *old, const struct ta_allocator *allocator,
+                       void *ptr, size_t old_size, size_t size)
+{
+    if (__ta_likely(!old && !allocator)) {
+        ptr = ta_heap_realloc(ptr, old_size, size);
+
+        // GCOVR_EXCL_START
+        if (__ta_unlikely(!ptr))
+            abort();
+        // GCOVR_EXCL_STOP
+
+        return ptr;
+    }
+
+    if (old == allocator && allocator->resize) {
+        ptr = allocator->resize(allocator->ctx, (uint8_t *)ptr - TA_BLOCK_PREFIX,
+                                TA_BLOCK_PREFIX + old_size, TA_BLOCK_PREFIX + size);
+
+        // GCOVR_EXCL_START
+        if (__ta_unlikely(!ptr))
+            abort();
+        // GCOVR_EXCL_STOP
+
+        return (uint8_t *)ptr + TA_BLOCK_PREFIX;
+    }
+
+    void *new_ptr = ta_block_alloc(allocator, size, false);
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+
+    if (old) {
+        old->release(old->ctx, (uint8_t *)ptr - TA_BLOCK_PREFIX, TA_BLOCK_PREFIX + old_size);
+    } else {
+        ta_heap_free(ptr, old_size);
+    }
+
+    return new_ptr;
+}
+
+// Turns a buffer from `malloc()` into a block, reusing the buffer if it can.
+static __ta_nodiscard __ta_returns_nonnull
+void *ta_block_adopt(const struct ta_allocator *allocator, void *ptr,
+                     size_t old_size, size_t size)
+{
+    if (__ta_likely(!allocator && !TA_SLAB_FITS(size) && !TA_MMAP_FITS(size))) {
+        ptr = realloc(ptr, ta_heap_size(size));
+
+        // GCOVR_EXCL_START
+        if (__ta_unlikely(!ptr))
+            abort();
+        // GCOVR_EXCL_STOP
+
+        return ptr;
+    }
+
+    void *block = ta_block_alloc(allocator, size, false);
+    memcpy(block, ptr, old_size);
+    free(ptr);
+    return block;
+}
+
+static __ta_inline
+void ta_block_free(const struct ta_allocator *allocator, void *ptr, size_t size)
+{
+    if (__ta_likely(!allocator)) {
+        ta_heap_free(ptr, size);
+    } else {
+        allocator->release(allocator->ctx, (uint8_t *)ptr - TA_BLOCK_PREFIX,
+                           TA_BLOCK_PREFIX + size);
+    }
+}
+
+#define TA_ARENA_SIZE ((size_t)64 << 10)
+#define TA_ARENA_MIN ((size_t)1 << 10)
+#define TA_ARENA_ROUND(size) (((size) + TA_BLOCK_ALIGN - 1) & ~(TA_BLOCK_ALIGN - 1))
+
+// Blocks of the arena are mapped with the flags of ta_arena_map().
+#define TA_ARENA_MAPPED (1U << 16)
+
+// The first block of the arena is a buffer of the caller, see ta_context_from_buffer().
+#define TA_ARENA_BUFFER (1U << 17)
+
+// Transparent huge pages are 2 MiB on the usual 4 KiB page systems.
+#define TA_ARENA_HUGE_PAGE ((size_t)2 << 20)
+
+struct ta_arena_block {
+    struct ta_arena_block *next;
+    struct ta_arena_block *prev; // only linked for large blocks
+    size_t size;
+    uint8_t *top; // where carving stopped in the next block
+};
+
+#define TA_ARENA_HEADER TA_ARENA_ROUND(sizeof(struct ta_arena_block))
+#define TA_ARENA_DATA(b) ((uint8_t *)(b) + TA_ARENA_HEADER)
+#define TA_ARENA_BLOCK(ptr) ((struct ta_arena_block *)((uint8_t *)(ptr) - TA_ARENA_HEADER))
+
+// Chunks of an arena are carved from its blocks with a bump pointer, chunks
+// larger than a quarter of a block get a block of their own. The arena itself
+// lives at the start of its first block, which is the last one in the list.
+// Blocks kept by ta_reset() wait on the spare list until carving reaches them.
+// Chunks may leave the arena as they are, so each one carved from it, the arena
+// chunk included, holds a reference to the blocks.
+//
+// Chunks carved and released are counted against the position of the newest mark,
+// which lets ta_release_to() tell whether anything carved after a mark is left.
+struct ta_arena {
+    struct ta_allocator allocator;
+    struct ta_arena_block *blocks;
+    struct ta_arena_block *spare;
+    struct ta_arena_block large;
+    uint8_t *cur;
+    uint8_t *end;
+    size_t size;
+    void *root; // block of the arena chunk, NULL once it is released
+    size_t refs;
+    size_t carved; // live chunks carved from the blocks
+    size_t released; // chunks released that were carved before the newest mark
+    struct ta_arena_block *mark_block; // NULL until a mark is taken
+    uint8_t *mark_cur;
+    unsigned flags;
+};
+
+#ifndef _WIN32
+// Faults in every page of a mapped block. MAP_POPULATE would fault in regular
+// pages before the block is advised to use huge ones.
+static void ta_arena_prefault(uint8_t *ptr, size_t size)
+{
+#ifdef MADV_POPULATE_WRITE
+    if (!madvise(ptr, size, MADV_POPULATE_WRITE))
+        return;
+#endif
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < size; i += page)
+        ((volatile uint8_t *)ptr)[i] = 0;
+}
+
+// Maps a block, rounding `size` up to whole pages. Blocks of huge pages start at
+// a huge page boundary, which takes mapping a huge page more and trimming it.
+static __ta_nodiscard
+struct ta_arena_block *ta_arena_map_block(size_t *size, unsigned flags)
+{
+    bool huge = (flags & TA_ARENA_HUGE) && *size >= TA_ARENA_HUGE_PAGE;
+    size_t page = huge ? TA_ARENA_HUGE_PAGE : (size_t)sysconf(_SC_PAGESIZE);
+    size_t len = (*size + page - 1) & ~(page - 1);
+    int mflags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+#ifdef MAP_POPULATE
+    if ((flags & TA_ARENA_PREFAULT) && !huge)
+        mflags |= MAP_POPULATE;
+#endif
+
+    uint8_t *ptr = (uint8_t *)mmap(NULL, huge ? len + page : len, PROT_READ | PROT_WRITE,
+                                   mflags, -1, 0);
+    if (__ta_unlikely(ptr == MAP_FAILED))
+        return NULL;
+
+    if (huge) {
+        size_t head = -(uintptr_t)ptr & (page - 1);
+        if (head)
+            munmap(ptr, head);
+        munmap(ptr + head + len, page - head);
+        ptr += head;
+#ifdef MADV_HUGEPAGE
+        madvise(ptr, len, MADV_HUGEPAGE);
+#endif
+    }
+
+#ifdef MAP_POPULATE
+    if ((flags & TA_ARENA_PREFAULT) && huge)
+        ta_arena_prefault(ptr, len);
+#else
+    if (flags & TA_ARENA_PREFAULT)
+        ta_arena_prefault(ptr, len);
+#endif
+
+    *size = len;
+    return (struct ta_arena_block *)ptr;
+}
+#endif
+
+// Allocates a block of at least `size` bytes, from libc or mapped.
+static __ta_nodiscard
+struct ta_arena_block *ta_arena_block_new(size_t size, unsigned flags)
+{
+    struct ta_arena_block *b;
+
+#ifndef _WIN32
+    if (flags & TA_ARENA_MAPPED) {
+        b = ta_arena_map_block(&size, flags);
+    } else
+#endif
+    {
+        b = (struct ta_arena_block *)malloc(size);
+    }
+
+    if (__ta_likely(b))
+        b->size = size;
+
+    return b;
+}
+
+static void ta_arena_block_free(struct ta_arena_block *b, unsigned flags)
+{
+#ifndef _WIN32
+    if (flags & TA_ARENA_MAPPED) {
+        munmap(b, b->size);
+        return;
+    }
+#endif
+    (void)flags;
+    free(b);
+}
+
+// Resizes a block, keeping its links. Mapped blocks are remapped on Linux unless
+// they have to stay aligned to huge pages, and copied otherwise.
+static __ta_nodiscard
+struct ta_arena_block *ta_arena_block_resize(struct ta_arena_block *b, size_t size,
+                                             unsigned flags)
+{
+    if (!(flags & TA_ARENA_MAPPED)) {
+        b = (struct ta_arena_block *)realloc(b, size);
+        if (__ta_likely(b))
+            b->size = size;
+        return b;
+    }
+
+#ifdef __linux__
+    if (!(flags & TA_ARENA_HUGE)) {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t old_size = b->size;
+        size = (size + page - 1) & ~(page - 1);
+
+        void *ptr = mremap(b, old_size, size, MREMAP_MAYMOVE);
+        if (__ta_unlikely(ptr == MAP_FAILED))
+            return NULL;
+
+        b = (struct ta_arena_block *)ptr;
+        b->size = size;
+        if ((flags & TA_ARENA_PREFAULT) && size > old_size)
+            ta_arena_prefault((uint8_t *)ptr + old_size, size - old_size);
+        return b;
+    }
+#endif
+
+    struct ta_arena_block *new_b = ta_arena_block_new(size, flags);
+    if (__ta_unlikely(!new_b))
+        return NULL;
+
+    size = new_b->size;
+    memcpy(new_b, b, b->size < size ? b->size : size);
+    new_b->size = size;
+    ta_arena_block_free(b, flags);
+    return new_b;
+}
+
+// Whether a chunk has a block of its own. Mapped arenas also carve large chunks
+// while the current block has room, so theirs are told apart by address.
+static __ta_nodiscard
+bool ta_arena_is_large(const struct ta_arena *arena, const void *ptr, size_t size)
+{
+    if (__ta_likely(size <= arena->size / 4))
+        return false;
+
+    if (!(arena->flags & TA_ARENA_MAPPED))
+        return true;
+
+    for (const struct ta_arena_block *b = arena->blocks; b; b = b->next) {
+        if ((const uint8_t *)ptr > (const uint8_t *)b &&
+            (const uint8_t *)ptr < (const uint8_t *)b + b->size)
+            return false;
+    }
+    return true;
+}
+
+static __ta_nodiscard
+void *ta_arena_alloc_large(struct ta_arena *arena, size_t size)
+{
+    struct ta_arena_block *b = ta_arena_block_new(TA_ARENA_HEADER + size, arena->flags);
+    if (__ta_unlikely(!b))
+        return NULL;
+
+    b->next = arena->large.next;
+    b->prev = &arena->large;
+    b->next->prev = b;
+    arena->large.next = b;
+    return TA_ARENA_DATA(b);
+}
+
+static __ta_nodiscard
+void *ta_arena_alloc(void *ctx, size_t size)
+{
+    struct ta_arena *arena = (struct ta_arena *)ctx;
+
+    // A mapped arena is reserved up front, so what fits its block is carved from
+    // it. The room left in mapped blocks is a multiple of the alignment.
+    if (__ta_unlikely(size > arena->size / 4) &&
+        (!(arena->flags & TA_ARENA_MAPPED) || size > (size_t)(arena->end - arena->cur))) {
+        void *ptr = ta_arena_alloc_large(arena, size);
+        arena->refs += ptr != NULL;
+        return ptr;
+    }
+
+    size = TA_ARENA_ROUND(size);
+    if (__ta_unlikely(size > (size_t)(arena->end - arena->cur))) {
+        struct ta_arena_block *b = arena->spare;
+        if (b) {
+            arena->spare = b->next;
+        } else {
+            b = ta_arena_block_new(arena->size, arena->flags);
+            if (__ta_unlikely(!b))
+                return NULL;
+        }
+
+        b->next = arena->blocks;
+        b->top = arena->cur;
+        arena->blocks = b;
+        arena->cur = TA_ARENA_DATA(b);
+        arena->end = (uint8_t *)b + b->size;
+    }
+
+    void *ptr = arena->cur;
+    arena->cur += size;
+    arena->refs++;
+    arena->carved++;
+    return ptr;
+}
+
+// Whether a carved chunk lies before the newest mark. Blocks carved after the mark
+// are newer than its block, so only those are searched.
+static __ta_nodiscard
+bool ta_arena_before_mark(const struct ta_arena *arena, const void *ptr)
+{
+    for (const struct ta_arena_block *b = arena->blocks; b != arena->mark_block; b = b->next) {
+        if ((const uint8_t *)ptr > (const uint8_t *)b &&
+            (const uint8_t *)ptr < (const uint8_t *)b + b->size)
+            return false;
+    }
+
+    const struct ta_arena_block *b = arena->mark_block;
+    return (const uint8_t *)ptr < arena->mark_cur ||
+           (const uint8_t *)ptr >= (const uint8_t *)b + b->size;
+}
+
+static void ta_arena_uncarve(struct ta_arena *arena, const void *ptr)
+{
+    arena->carved--;
+    if (arena->mark_block && ta_arena_before_mark(arena, ptr))
+        arena->released++;
+}
+
+// Frees the spare blocks of an arena beyond the first `retain` bytes of them.
+static size_t ta_arena_shed(struct ta_arena *arena, size_t retain)
+{
+    struct ta_arena_block **link = &arena->spare;
+    size_t kept = 0, released = 0;
+
+    while (*link) {
+        struct ta_arena_block *b = *link;
+        if (kept + b->size <= retain) {
+            kept += b->size;
+            link = &b->next;
+        } else {
+            *link = b->next;
+            released += b->size;
+            ta_arena_block_free(b, arena->flags);
+        }
+    }
+
+    return released;
+}
+
+static void ta_arena_drop(struct ta_arena *arena)
+{
+    // The arena goes away with its first block.
+    unsigned flags = arena->flags;
+
+    ta_arena_shed(arena, 0);
+
+    struct ta_arena_block *b = arena->large.next;
+    while (b != &arena->large) {
+        struct ta_arena_block *next = b->next;
+        ta_arena_block_free(b, flags);
+        b = next;
+    }
+
+    b = arena->blocks;
+    while (b) {
+        struct ta_arena_block *next = b->next;
+        if (!next && (flags & TA_ARENA_BUFFER))
+            break;
+        ta_arena_block_free(b, flags);
+        b = next;
+    }
+}
+
+static void ta_arena_release(void *ctx, void *ptr, size_t size)
+{
+    struct ta_arena *arena = (struct ta_arena *)ctx;
+
+    if (ptr == arena->root) {
+        arena->root = NULL;
+        if (!ta_arena_is_large(arena, ptr, size))
+            ta_arena_uncarve(arena, ptr);
+    } else if (__ta_unlikely(ta_arena_is_large(arena, ptr, size))) {
+        struct ta_arena_block *b = TA_ARENA_BLOCK(ptr);
+        b->prev->next = b->next;
+        b->next->prev = b->prev;
+        ta_arena_block_free(b, arena->flags);
+    } else {
+        ta_arena_uncarve(arena, ptr);
+
+        // Only the last carved block can be handed out again. Releasing chunks
+        // in reverse order empties blocks, carving then goes back to the one before.
+        // The newest mark goes down along, nothing is carved above it anymore.
+        struct ta_arena_block *b = arena->blocks;
+        if ((uint8_t *)ptr + TA_ARENA_ROUND(size) == arena->cur) {
+            arena->cur = (uint8_t *)ptr;
+            if (b == arena->mark_block && arena->cur < arena->mark_cur)
+                arena->mark_cur = arena->cur;
+
+            if (arena->cur == TA_ARENA_DATA(b) && b->next) {
+                if (b == arena->mark_block) {
+                    arena->mark_block = b->next;
+                    arena->mark_cur = b->top;
+                }
+                arena->blocks = b->next;
+                arena->cur = b->top;
+                arena->end = (uint8_t *)b->next + b->next->size;
+                b->next = arena->spare;
+                arena->spare = b;
+            }
+        }
+    }
+
+    // The blocks go once the arena chunk and the chunks carved from it are gone.
+    if (--arena->refs == 0)
+        ta_arena_drop(arena);
+}
+
+static __ta_nodiscard
+void *ta_arena_resize(void *ctx, void *ptr, size_t old_size, size_t size)
+{
+    struct ta_arena *arena = (struct ta_arena *)ctx;
+    size_t large = arena->size / 4;
+    bool was_large = ta_arena_is_large(arena, ptr, old_size);
+    void *new_ptr;
+
+    if (was_large && size > large) {
+        struct ta_arena_block *b = ta_arena_block_resize(TA_ARENA_BLOCK(ptr),
+                                                         TA_ARENA_HEADER + size, arena->flags);
+        if (__ta_unlikely(!b))
+            return NULL;
+
+        b->prev->next = b;
+        b->next->prev = b;
+        new_ptr = TA_ARENA_DATA(b);
+    } else if (!was_large && (size <= large || (arena->flags & TA_ARENA_MAPPED)) &&
+               (uint8_t *)ptr + TA_ARENA_ROUND(old_size) == arena->cur &&
+               TA_ARENA_ROUND(size) <= (size_t)(arena->end - (uint8_t *)ptr) &&
+               !(arena->blocks == arena->mark_block && (uint8_t *)ptr < arena->mark_cur &&
+                 (uint8_t *)ptr + TA_ARENA_ROUND(size) > arena->mark_cur)) {
+        // The last carved block grows or shrinks in place, unless it would grow
+        // past the newest mark, which is rewound to when what follows it is gone.
+        arena->cur = (uint8_t *)ptr + TA_ARENA_ROUND(size);
+        if (arena->blocks == arena->mark_block && arena->cur < arena->mark_cur)
+            arena->mark_cur = arena->cur;
+        return ptr;
+    } else {
+        new_ptr = ta_arena_alloc(arena, size);
+        if (__ta_unlikely(!new_ptr))
+            return NULL;
+
+        memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+        if (ptr != arena->root) {
+            ta_arena_release(arena, ptr, old_size);
+        } else {
+            arena->refs--;
+            if (!was_large)
+                ta_arena_uncarve(arena, ptr);
+        }
+    }
+
+    if (ptr == arena->root)
+        arena->root = new_ptr;
+
+    return new_ptr;
+}
+
+static __ta_inline __ta_nodiscard
+struct ta_arena *ta_arena_from_allocator(const struct ta_allocator *allocator)
+{
+    return allocator && allocator->release == ta_arena_release
+           ? (struct ta_arena *)allocator->ctx
+           : NULL;
+}
+
+// Rewinds the arena to a mark once every chunk carved after it is released. The
+// count of chunks carved then and released before the newest mark since only
+// matches when none is left; chunks released out of order do not lower the bump
+// pointer on their own.
+static void ta_arena_rollback(struct ta_arena *arena, struct ta_mark mark)
+{
+    if (!mark.block || arena->carved + arena->released != mark.carved)
+        return;
+
+    struct ta_arena_block *b = arena->blocks;
+    while (b && b != mark.block)
+        b = b->next;
+
+    uint8_t *cur = (uint8_t *)mark.cur;
+    if (!b || (b == arena->blocks && cur >= arena->cur))
+        return;
+
+    // Blocks carved after the mark are empty, they become spare ones.
+    bool moved = false;
+    while (arena->blocks != b) {
+        struct ta_arena_block *next = arena->blocks->next;
+        moved |= arena->blocks == arena->mark_block;
+        arena->blocks->next = arena->spare;
+        arena->spare = arena->blocks;
+        arena->blocks = next;
+    }
+
+    arena->cur = cur;
+    arena->end = (uint8_t *)b + b->size;
+    if (moved || (b == arena->mark_block && cur < arena->mark_cur)) {
+        arena->mark_block = b;
+        arena->mark_cur = cur;
+    }
+}
+
+// Chunks of a pool are carved from the rest of its block with a bump pointer, and
+// come from libc once it is full. As on an arena every chunk on the pool holds a
+// reference to the block, which lets them leave the pool as they are.
+struct ta_pool {
+    struct ta_allocator allocator;
+    uint8_t *cur;
+    uint8_t *end;
+    size_t refs;
+    bool bulk; // made by ta_alloc_many(), children of its chunks do not inherit it
+};
+
+static __ta_inline __ta_nodiscard
+bool ta_pool_owns(const struct ta_pool *pool, const void *ptr)
+{
+    return (const uint8_t *)ptr > (const uint8_t *)pool && (const uint8_t *)ptr < pool->end;
+}
+
+static __ta_nodiscard
+void *ta_pool_alloc(void *ctx, size_t size)
+{
+    struct ta_pool *pool = (struct ta_pool *)ctx;
+    void *ptr;
+
+    if (TA_ARENA_ROUND(size) <= (size_t)(pool->end - pool->cur)) {
+        ptr = pool->cur;
+        pool->cur += TA_ARENA_ROUND(size);
+    } else {
+        ptr = malloc(size);
+        if (__ta_unlikely(!ptr))
+            return NULL;
+    }
+
+    pool->refs++;
+    return ptr;
+}
+
+static void ta_pool_release(void *ctx, void *ptr, size_t size)
+{
+    struct ta_pool *pool = (struct ta_pool *)ctx;
+
+    if (!ta_pool_owns(pool, ptr)) {
+        free(ptr);
+    } else if ((uint8_t *)ptr + TA_ARENA_ROUND(size) == pool->cur) {
+        pool->cur = (uint8_t *)ptr;
+    }
+
+    // The block goes once the pool and the chunks carved from it are gone.
+    if (--pool->refs == 0)
+        free(pool);
+}
+
+static __ta_nodiscard
+void *ta_pool_resize(void *ctx, void *ptr, size_t old_size, size_t size)
+{
+    struct ta_pool *pool = (struct ta_pool *)ctx;
+
+    if (!ta_pool_owns(pool, ptr))
+        return realloc(ptr, size);
+
+    if ((uint8_t *)ptr + TA_ARENA_ROUND(old_size) == pool->cur &&
+        TA_ARENA_ROUND(size) <= (size_t)(pool->end - (uint8_t *)ptr)) {
+        // The last carved chunk grows or shrinks in place.
+        pool->cur = (uint8_t *)ptr + TA_ARENA_ROUND(size);
+        return ptr;
+    }
+
+    void *new_ptr = ta_pool_alloc(pool, size);
+    if (__ta_unlikely(!new_ptr))
+        return NULL;
+
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    ta_pool_release(pool, ptr, old_size);
+    return new_ptr;
+}
+
+// Allocates a pool with room for `size` bytes of chunks.
+static __ta_nodiscard __ta_returns_nonnull
+struct ta_pool *ta_pool_new(size_t size, bool bulk)
+{
+    size_t header = TA_ARENA_ROUND(sizeof(struct ta_pool));
+    struct ta_pool *pool = (struct ta_pool *)malloc(header + size);
+
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(!pool))
+        abort();
+    // GCOVR_EXCL_STOP
+
+    *pool = (struct ta_pool) {
+        .allocator = {
+            .alloc   = ta_pool_alloc,
+            .resize  = ta_pool_resize,
+            .release = ta_pool_release,
+            .ctx     = pool,
+        },
+        .cur  = (uint8_t *)pool + header,
+        .end  = (uint8_t *)pool + header + size,
+        .bulk = bulk,
+    };
+
+    return pool;
+}
+
+#define TA_MAP_SHARDS 64
+
+struct ta_map_entry {
+    uintptr_t key;
+    union {
+        ta_destructor destructor;
+        struct ta_header *header;
+        size_t mark;
+    } value;
+};
+
+struct ta_map_shard {
+    atomic_int lock;
+    size_t count;
+    size_t mask;
+    struct ta_map_entry *entries;
+};
+
+struct ta_map {
+    struct ta_map_shard shards[TA_MAP_SHARDS];
+};
+
+// Keys from the same page get neighbouring slots of the same shard, so the map
+// is about as cache friendly as a page map, while pages are spread by hashing.
+static __ta_inline __ta_nodiscard
+size_t ta_map_hash(uintptr_t key)
+{
+    uint64_t page = (uint64_t)(key >> 12) * 0x9E3779B97F4A7C15ULL;
+    return (size_t)(page >> 40) << 8 | ((key >> 4) & 0xFF);
+}
+
+#define TA_MAP_SHARD(hash) (((hash) >> 8) % TA_MAP_SHARDS)
+#define TA_MAP_SLOT(hash) (((hash) >> 8) / TA_MAP_SHARDS << 8 | ((hash) & 0xFF))
+
+static __ta_inline __ta_nodiscard __ta_returns_nonnull
+struct ta_map_shard *ta_map_lock(struct ta_map *map, size_t hash)
+{
+    struct ta_map_shard *s = &map->shards[TA_MAP_SHARD(hash)];
+    ta_spin_lock(&s->lock);
+    return s;
+}
+
+static __ta_inline
+void ta_map_unlock(struct ta_map_shard *s)
+{
+    ta_spin_unlock(&s->lock);
+}
+
+static __ta_inline __ta_nodiscard
+size_t ta_map_find(const struct ta_map_shard *s, size_t hash, uintptr_t key)
+{
+    size_t i = TA_MAP_SLOT(hash) & s->mask;
+    while (s->entries[i].key && s->entries[i].key != key)
+        i = (i + 1) & s->mask;
+    return i;
+}
+
+static void ta_map_grow(struct ta_map_shard *s)
+{
+    size_t n = s->entries ? (s->mask + 1) * 2 : 16;
+    struct ta_map_shard tmp = {
+        .mask    = n - 1,
+        .entries = (struct ta_map_entry *)calloc(n, sizeof(struct ta_map_entry)),
+    };
+
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(!tmp.entries))
+        abort();
+    // GCOVR_EXCL_STOP
+
+    for (size_t i = 0; s->entries && i <= s->mask; ++i) {
+        uintptr_t key = s->entries[i].key;
+        if (key)
+            tmp.entries[ta_map_find(&tmp, ta_map_hash(key), key)] = s->entries[i];
+    }
+
+    free(s->entries);
+    s->entries = tmp.entries;
+    s->mask = tmp.mask;
+}
+
+static void ta_map_put(struct ta_map *map, struct ta_map_entry entry)
+{
+    size_t hash = ta_map_hash(entry.key);
+    struct ta_map_shard *s = ta_map_lock(map, hash);
+
+    if (!s->entries || (s->count + 1) * 4 > (s->mask + 1) * 3)
+        ta_map_grow(s);
+
+    size_t i = ta_map_find(s, hash, entry.key);
+    if (!s->entries[i].key)
+        s->count++;
+
+    s->entries[i] = entry;
+    ta_map_unlock(s);
+}
+
+// Returns an entry with a zero key if there is none.
+static __ta_nodiscard
+struct ta_map_entry ta_map_get(struct ta_map *map, uintptr_t key)
+{
+    size_t hash = ta_map_hash(key);
+    struct ta_map_shard *s = ta_map_lock(map, hash);
+    struct ta_map_entry entry = { 0 };
+    if (s->entries)
+        entry = s->entries[ta_map_find(s, hash, key)];
+    ta_map_unlock(s);
+    return entry;
+}
+
+static void ta_map_del(struct ta_map *map, uintptr_t key)
+{
+    size_t hash = ta_map_hash(key);
+    struct ta_map_shard *s = ta_map_lock(map, hash);
+
+    if (!--s->count) {
+        free(s->entries);
+        s->entries = NULL;
+        s->mask = 0;
+        ta_map_unlock(s);
+        return;
+    }
+
+    // Backward shift deletion keeps the probe sequences intact.
+    size_t i = ta_map_find(s, hash, key);
+    for (size_t j = (i + 1) & s->mask; s->entries[j].key; j = (j + 1) & s->mask) {
+        size_t k = TA_MAP_SLOT(ta_map_hash(s->entries[j].key)) & s->mask;
+        if (((j - k) & s->mask) >= ((j - i) & s->mask)) {
+            s->entries[i] = s->entries[j];
+            i = j;
+        }
+    }
+    s->entries[i].key = 0;
+
+    ta_map_unlock(s);
+}
+
+#if TA_COMPACT
+// Destructors of all compact chunks, keyed by header address.
+static struct ta_map ta_dtor_map;
+#endif
+
+// Marks of the children that ended the children of their parent when the marks
+// were taken, keyed by header address. Marks are numbered in the order they are
+// taken, see ta_mark().
+static struct ta_map ta_mark_map;
+static atomic_size_t ta_mark_seq;
+
+#if TA_OUTLINE
+// Headers of all chunks, keyed by payload address.
+static struct ta_map ta_header_map;
+
+struct ta_header_slab {
+    struct ta_header_slab *next;
+    struct ta_header headers[TA_HDR_SLAB];
+};
+
+// Released headers are kept for reuse, linked through `next`. Slabs are never
+// returned.
+static struct {
+    atomic_int lock;
+    struct ta_header *free;
+    struct ta_header_slab *slabs;
+} ta_header_pool;
+
+// Bumped whenever a payload leaves its header, before its block can be reused.
+static atomic_size_t ta_header_epoch;
+
+// The header that last handed out its payload. Walking a tree passes the same
+// pointer right back, so this saves most lookups in the header map. The hint
+// keeps its own copy of the payload address and is void once the epoch moves,
+// so checking it never reads a header that another thread may be releasing.
+static _Thread_local struct {
+    const void *ptr;
+    struct ta_header *header;
+    size_t epoch;
+} ta_header_hint;
+
+static __ta_inline __ta_nodiscard __ta_returns_nonnull
+void *ta_header_ptr(struct ta_header *h)
+{
+    ta_header_hint.ptr = h->ptr;
+    ta_header_hint.header = h;
+    ta_header_hint.epoch = atomic_load_explicit(&ta_header_epoch, memory_order_relaxed);
+    return h->ptr;
+}
+
+// Takes the payload of `h` out of the header map, which also voids the hints of
+// all threads. Whoever gets the block next is ordered after this by libc, and so
+// is a thread that learns its address from them.
+static __ta_inline
+void ta_header_forget(const struct ta_header *h)
+{
+    atomic_fetch_add_explicit(&ta_header_epoch, 1, memory_order_relaxed);
+    ta_map_del(&ta_header_map, (uintptr_t)h->ptr);
+}
+
+#define TA_PTR_FROM_HDR(hdr) ta_header_ptr(hdr)
+
+static __ta_nodiscard __ta_returns_nonnull
+struct ta_header *ta_header_attach(void *ptr)
+{
+    ta_spin_lock(&ta_header_pool.lock);
+
+    struct ta_header *h = ta_header_pool.free;
+    if (__ta_unlikely(!h)) {
+        struct ta_header_slab *slab =
+            (struct ta_header_slab *)calloc(1, sizeof(struct ta_header_slab));
+
+        // GCOVR_EXCL_START
+        if (__ta_unlikely(!slab))
+            abort();
+        // GCOVR_EXCL_STOP
+
+        for (size_t i = 0; i < TA_HDR_SLAB - 1; ++i)
+            slab->headers[i].next = &slab->headers[i + 1];
+
+        slab->next = ta_header_pool.slabs;
+        ta_header_pool.slabs = slab;
+        h = slab->headers;
+    }
+
+    ta_header_pool.free = h->next;
+    ta_spin_unlock(&ta_header_pool.lock);
+
+    h->ptr = ptr;
+    return h;
+}
+#endif
+
+static __ta_inline __ta_nodiscard __ta_returns_nonnull
+struct ta_header *ta_header_from_ptr(const void *ptr)
+{
+#if TA_OUTLINE
+    struct ta_header *h = ta_header_hint.header;
+    size_t epoch = atomic_load_explicit(&ta_header_epoch, memory_order_relaxed);
+
+    if (__ta_unlikely(!h || ta_header_hint.ptr != ptr || ta_header_hint.epoch != epoch)) {
+        h = ta_map_get(&ta_header_map, (uintptr_t)ptr).value.header;
+
+        // GCOVR_EXCL_START
+        if (__ta_unlikely(!h))
+            abort();
+        // GCOVR_EXCL_STOP
+    }
+#else
+    // GCOVR_EXCL_START
+    if (__ta_unlikely((uintptr_t)ptr <= TA_HDR_SIZE))
+        abort();
+    // GCOVR_EXCL_STOP
+
+    struct ta_header *h = TA_HDR_FROM_PTR(ptr);
+#endif
+
+#if TA_MAGIC
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(h->magic != TA_MAGIC))
+        abort();
+    // GCOVR_EXCL_STOP
+#endif
+
+    return h;
+}
+
+// The part of a block that TA_BLOCK_SIZE() covers.
+static __ta_inline __ta_nodiscard __ta_returns_nonnull
+uint8_t *ta_header_front(const struct ta_header *h)
+{
+#if TA_OUTLINE
+    return (uint8_t *)h->ptr;
+#else
+    return (uint8_t *)h;
+#endif
+}
+
+// The alignment of a chunk and its padding, both 0 for a chunk that is not aligned.
+static __ta_inline __ta_nodiscard
+struct ta_align ta_header_get_align(const struct ta_header *h)
+{
+    struct ta_align a = {0, 0};
+
+    if (__ta_unlikely(h->size & TA_SIZE_ALIGNED))
+        memcpy(&a, ta_header_front(h) - TA_ALIGN_PAD, sizeof(a));
+
+    return a;
+}
+
+// Places a chunk aligned to `align` in a block and returns its front.
+static __ta_inline __ta_nodiscard __ta_returns_nonnull
+uint8_t *ta_align_front(uint8_t *block, size_t align, size_t pad)
+{
+    struct ta_align a = { align, pad };
+    memcpy(block + pad - TA_ALIGN_PAD, &a, sizeof(a));
+    return block + pad;
+}
+
+// The padding that aligns the payload of a chunk placed in a block to `align`.
+static __ta_inline __ta_nodiscard
+size_t ta_align_pad(const uint8_t *block, size_t align)
+{
+    uintptr_t ptr = (uintptr_t)block + TA_ALIGN_PAD + TA_HDR_SIZE;
+    return TA_ALIGN_PAD + (-ptr & (align - 1));
+}
+
+// The start of the block of a chunk from a custom allocator.
+static __ta_inline __ta_nodiscard __ta_returns_nonnull
+void *ta_header_block(const struct ta_header *h)
+{
+    return ta_header_front(h) - ta_header_get_align(h).pad - TA_BLOCK_PREFIX;
+}
+
+// The allocator a chunk came from, NULL for libc.
+static __ta_inline __ta_nodiscard
+const struct ta_allocator *ta_header_get_allocator(const struct ta_header *h)
+{
+    if (!(h->size & TA_SIZE_ALLOCATOR))
+        return NULL;
+
+    const struct ta_allocator *allocator;
+    memcpy(&allocator, ta_header_block(h), sizeof(allocator));
+    return allocator;
+}
+
+// New chunks inherit the allocator of their parent, unless it only made room for
+// the chunks of a ta_alloc_many() call.
+static __ta_inline __ta_nodiscard
+const struct ta_allocator *ta_header_inherit(const struct ta_header *h_parent)
+{
+    const struct ta_allocator *allocator = h_parent ? ta_header_get_allocator(h_parent) : NULL;
+
+    if (__ta_unlikely(allocator) && allocator->release == ta_pool_release &&
+        ((const struct ta_pool *)allocator->ctx)->bulk)
+        return NULL;
+
+    return allocator;
+}
+
+// Allocates a chunk, the header is initialized later by ta_header_init().
+static __ta_inline __ta_nodiscard __ta_returns_nonnull
+struct ta_header *ta_header_alloc(const struct ta_allocator *allocator, size_t size, bool zero)
+{
+    void *ptr = ta_block_alloc(allocator, TA_BLOCK_SIZE(size), zero);
+
+#if TA_OUTLINE
+    return ta_header_attach(ptr);
+#else
+    return (struct ta_header *)ptr;
+#endif
+}
+
+// Allocates a chunk whose payload is aligned to `align`, see ta_header_alloc().
+static __ta_nodiscard __ta_returns_nonnull
+struct ta_header *ta_header_alloc_aligned(const struct ta_allocator *allocator,
+                                          size_t align, size_t size, bool zero)
+{
+    uint8_t *block = (uint8_t *)ta_block_alloc(allocator,
+                                               TA_ALIGN_SPAN(align) + TA_BLOCK_SIZE(size), zero);
+    void *ptr = ta_align_front(block, align, ta_align_pad(block, align));
+
+#if TA_OUTLINE
+    return ta_header_attach(ptr);
+#else
+    return (struct ta_header *)ptr;
+#endif
+}
+
+static __ta_inline __ta_nodiscard
+ta_destructor ta_header_get_destructor(const struct ta_header *h)
+{
+#if TA_COMPACT
+    return (h->size & TA_SIZE_DESTRUCTOR)
+           ? ta_map_get(&ta_dtor_map, (uintptr_t)h).value.destructor
+           : NULL;
+#elif TA_DESTRUCTORS
+    return h->destructor;
+#else
+    (void)h;
+    return NULL;
+#endif
+}
+
+static __ta_inline
+void ta_header_set_destructor(struct ta_header *h, ta_destructor destructor)
+{
+#if TA_COMPACT
+    if (destructor) {
+        ta_map_put(&ta_dtor_map, (struct ta_map_entry) {
+            .key              = (uintptr_t)h,
+            .value.destructor = destructor,
+        });
+        h->size |= TA_SIZE_DESTRUCTOR;
+    } else if (h->size & TA_SIZE_DESTRUCTOR) {
+        ta_map_del(&ta_dtor_map, (uintptr_t)h);
+        h->size &= ~TA_SIZE_DESTRUCTOR;
+    }
+#elif TA_DESTRUCTORS
+    h->destructor = destructor;
+#else
+    (void)h;
+    (void)destructor;
+#endif
+}
+
+static __ta_inline __ta_nodiscard
+size_t ta_header_get_mark(const struct ta_header *h)
+{
+    return ta_map_get(&ta_mark_map, (uintptr_t)h).value.mark;
+}
+
+static __ta_inline
+void ta_header_set_mark(struct ta_header *h, size_t mark)
+{
+    ta_map_put(&ta_mark_map, (struct ta_map_entry) {
+        .key        = (uintptr_t)h,
+        .value.mark = mark,
+    });
+    h->size |= TA_SIZE_MARKED;
+}
+
+static __ta_inline
+void ta_header_clear_mark(struct ta_header *h)
+{
+    ta_map_del(&ta_mark_map, (uintptr_t)h);
+    h->size &= ~TA_SIZE_MARKED;
+}
+
+// Hands the marks of the siblings from `h_first` to `h_last`, which leave the list,
+// to the sibling after them. Older marks are further down the list, so the last
+// one of the run is the oldest, and one the next sibling has is older still.
+static void ta_header_pass_marks(struct ta_header *h_first, struct ta_header *h_last)
+{
+    size_t mark = 0;
+    for (struct ta_header *h = h_first;; h = h->next) {
+        if (h->size & TA_SIZE_MARKED) {
+            mark = ta_header_get_mark(h);
+            ta_header_clear_mark(h);
+        }
+        if (h == h_last)
+            break;
+    }
+
+    struct ta_header *h_next = h_last->next;
+    if (mark && h_next && !(h_next->size & TA_SIZE_MARKED))
+        ta_header_set_mark(h_next, mark);
+}
+
+static __ta_inline __ta_nodiscard
+bool ta_header_has_destructors(const struct ta_header *h)
+{
+    return h->size & TA_SIZE_DESTRUCTORS;
+}
+
+static __ta_inline
+void ta_header_mark_destructors(struct ta_header *h)
+{
+    for (; h && !ta_header_has_destructors(h); h = h->parent)
+        h->size |= TA_SIZE_DESTRUCTORS;
+}
+
+#if TA_CHILD_ARRAY
+// Counts the occupied slots of the array in a Fenwick tree, so a position among
+// the children survives the holes. It is built by the first `ta_get_child_at()`
+// on a parent with holes and kept up to date from then on.
+static void ta_array_rank_build(struct ta_array *a)
+{
+    size_t *rank = (size_t *)malloc(a->capacity * sizeof(size_t));
+
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(!rank))
+        abort();
+    // GCOVR_EXCL_STOP
+
+    for (size_t i = 0; i < a->capacity; ++i)
+        rank[i] = i >= a->begin && i < a->end && a->items[i];
+
+    for (size_t i = 1; i <= a->capacity; ++i) {
+        size_t j = i + (i & -i);
+        if (j <= a->capacity)
+            rank[j - 1] += rank[i - 1];
+    }
+
+    a->rank = rank;
+}
+
+// Adds `delta`, which wraps around for a removal, to the count of slot `i`.
+static __ta_inline
+void ta_array_rank_add(struct ta_array *a, size_t i, size_t delta)
+{
+    for (++i; i <= a->capacity; i += i & -i)
+        a->rank[i - 1] += delta;
+}
+
+// The slot of the occupied one with `k` others below it.
+static __ta_inline __ta_nodiscard
+size_t ta_array_rank_find(const struct ta_array *a, size_t k)
+{
+    size_t i = 0, step = 1;
+    while (step * 2 <= a->capacity)
+        step *= 2;
+
+    for (; step; step /= 2) {
+        if (i + step <= a->capacity && a->rank[i + step - 1] <= k) {
+            i += step;
+            k -= a->rank[i - 1];
+        }
+    }
+    return i;
+}
+
+// Rebuilds the child array of `h` without holes and with room for `front` more
+// children before the last one. The first build takes the children from the list.
+static void ta_array_rebuild(struct ta_header *h, size_t front)
+{
+    size_t count = ta_header_count_children(h);
+    size_t capacity = front + count * 2 + TA_ARRAY_MIN;
+    struct ta_array *a = (struct ta_array *)malloc(sizeof(struct ta_array) +
+                                                   capacity * sizeof(struct ta_header *));
+
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(!a))
+        abort();
+    // GCOVR_EXCL_STOP
+
+    a->begin = a->end = front + count / 2;
+    a->holes = 0;
+    a->capacity = capacity;
+    a->rank = NULL;
+
+    struct ta_array *a_old = h->array;
+    if (a_old) {
+        for (size_t i = a_old->begin; i < a_old->end; ++i) {
+            struct ta_header *h_child = a_old->items[i];
+            if (h_child) {
+                h_child->index = a->end;
+                a->items[a->end++] = h_child;
+            }
+        }
+        if (a_old->rank) {
+            free(a_old->rank);
+            ta_array_rank_build(a);
+        }
+        free(a_old);
+    } else {
+        a->end += count;
+        size_t i = a->end;
+        for (struct ta_header *h_child = h->list; h_child; h_child = h_child->next) {
+            h_child->index = --i;
+            a->items[i] = h_child;
+        }
+    }
+
+    h->array = a;
+}
+
+// Doubles the room at the end of the array. Unlike a rebuild it keeps the
+// indices, so the children themselves are not touched.
+static struct ta_array *ta_array_grow(struct ta_header *h)
+{
+    struct ta_array *a = h->array;
+    size_t capacity = a->capacity * 2;
+    a = (struct ta_array *)realloc(a, sizeof(struct ta_array) +
+                                   capacity * sizeof(struct ta_header *));
+
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(!a))
+        abort();
+    // GCOVR_EXCL_STOP
+
+    a->capacity = capacity;
+    if (a->rank) {
+        free(a->rank);
+        ta_array_rank_build(a);
+    }
+    return h->array = a;
+}
+
+static __ta_inline
+void ta_array_drop(struct ta_header *h)
+{
+    if (h->array) {
+        free(h->array->rank);
+        free(h->array);
+        h->array = NULL;
+    }
+}
+
+static __ta_inline
+void ta_array_push(struct ta_header *restrict h_parent, struct ta_header *restrict h)
+{
+    struct ta_array *a = h_parent->array;
+
+    if (__ta_unlikely(a->end == a->capacity))
+        a = ta_array_grow(h_parent);
+
+    h->index = a->end;
+    a->items[a->end++] = h;
+
+    if (a->rank)
+        ta_array_rank_add(a, h->index, 1);
+}
+
+static __ta_inline
+void ta_array_remove(struct ta_header *restrict h_parent, struct ta_header *restrict h)
+{
+    struct ta_array *a = h_parent->array;
+
+    a->items[h->index] = NULL;
+    a->holes++;
+
+    if (a->rank)
+        ta_array_rank_add(a, h->index, SIZE_MAX);
+
+    while (a->end > a->begin && !a->items[a->end - 1]) {
+        a->end--;
+        a->holes--;
+    }
+    while (a->begin < a->end && !a->items[a->begin]) {
+        a->begin++;
+        a->holes--;
+    }
+
+    if (ta_header_get_count(h_parent) < TA_ARRAY_MIN / 2) {
+        ta_array_drop(h_parent);
+    } else if (a->holes > ta_header_get_count(h_parent)) {
+        ta_array_rebuild(h_parent, 0);
+    }
+}
+
+// The next child of a walk: the ones after it are prefetched, since their
+// addresses are known without chasing the list.
+static __ta_inline __ta_nodiscard
+struct ta_header *ta_array_next(const struct ta_array *a, size_t i)
+{
+    if (i >= a->begin + TA_ARRAY_PREFETCH)
+        __ta_prefetch(a->items[i - TA_ARRAY_PREFETCH]);
+
+    while (i-- > a->begin) {
+        if (a->items[i])
+            return a->items[i];
+    }
+    return NULL;
+}
+
+static __ta_inline __ta_nodiscard
+struct ta_header *ta_array_prev(const struct ta_array *a, size_t i)
+{
+    if (i + TA_ARRAY_PREFETCH < a->end)
+        __ta_prefetch(a->items[i + TA_ARRAY_PREFETCH]);
+
+    while (++i < a->end) {
+        if (a->items[i])
+            return a->items[i];
+    }
+    return NULL;
+}
+#endif
+
+#if TA_NAMES
+static __ta_inline __ta_nodiscard
+size_t ta_name_hash(const char *name)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (; *name; ++name)
+        hash = (hash ^ (uint8_t)*name) * 0x100000001B3ULL;
+    return (size_t)hash;
+}
+
+static __ta_nodiscard __ta_returns_nonnull
+struct ta_names *ta_names_alloc(size_t capacity)
+{
+    struct ta_names *n = (struct ta_names *)calloc(1, sizeof(struct ta_names) +
+                                                   capacity * sizeof(struct ta_names_entry));
+
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(!n))
+        abort();
+    // GCOVR_EXCL_STOP
+
+    n->mask = capacity - 1;
+    return n;
+}
+
+static __ta_inline
+void ta_names_put(struct ta_names *n, size_t hash, struct ta_header *h)
+{
+    size_t i = hash & n->mask;
+    while (n->entries[i].header)
+        i = (i + 1) & n->mask;
+
+    n->entries[i].hash = hash;
+    n->entries[i].header = h;
+    n->count++;
+}
+
+// Indexes the named children of `h`, with the table at most half full.
+static void ta_names_build(struct ta_header *h)
+{
+    size_t count = ta_header_count_children(h);
+    size_t capacity = TA_NAMES_MIN;
+    while (capacity < count * 2)
+        capacity *= 2;
+
+    struct ta_names *n = ta_names_alloc(capacity);
+    for (struct ta_header *h_child = h->list; h_child; h_child = h_child->next) {
+        if (h_child->name)
+            ta_names_put(n, ta_name_hash(h_child->name), h_child);
+    }
+
+    h->names = n;
+}
+
+static __ta_inline
+void ta_names_drop(struct ta_header *h)
+{
+    free(h->names);
+    h->names = NULL;
+}
+
+static void ta_names_insert(struct ta_header *restrict h_parent, struct ta_header *restrict h)
+{
+    struct ta_names *n = h_parent->names;
+
+    if (__ta_unlikely((n->count + 1) * 4 > (n->mask + 1) * 3)) {
+        struct ta_names *n_old = n;
+        n = ta_names_alloc((n_old->mask + 1) * 2);
+        for (size_t i = 0; i <= n_old->mask; ++i) {
+            if (n_old->entries[i].header)
+                ta_names_put(n, n_old->entries[i].hash, n_old->entries[i].header);
+        }
+        free(n_old);
+        h_parent->names = n;
+    }
+
+    ta_names_put(n, ta_name_hash(h->name), h);
+}
+
+static void ta_names_remove(struct ta_header *restrict h_parent, struct ta_header *restrict h)
+{
+    struct ta_names *n = h_parent->names;
+    size_t i = ta_name_hash(h->name) & n->mask;
+    while (n->entries[i].header != h)
+        i = (i + 1) & n->mask;
+
+    // Backward shift deletion keeps the probe sequences intact.
+    for (size_t j = (i + 1) & n->mask; n->entries[j].header; j = (j + 1) & n->mask) {
+        size_t k = n->entries[j].hash & n->mask;
+        if (((j - k) & n->mask) >= ((j - i) & n->mask)) {
+            n->entries[i] = n->entries[j];
+            i = j;
+        }
+    }
+
+    n->entries[i].header = NULL;
+    n->count--;
+}
+#endif
+
+// Whether the children of `h` are also indexed, which the list alone does not
+// keep up to date.
+static __ta_inline __ta_nodiscard
+bool ta_header_has_index(const struct ta_header *h)
+{
+#if TA_CHILD_ARRAY
+    if (h->array)
+        return true;
+#endif
+#if TA_NAMES
+    if (h->names)
+        return true;
+#endif
+    (void)h;
+    return false;
+}
+
+#if !TA_BACKLINKS
+// The sibling before `h`, which must not be the first child.
+static __ta_inline __ta_nodiscard __ta_returns_nonnull
+struct ta_header *ta_header_find_prev(const struct ta_header *h_parent,
+                                      const struct ta_header *h)
+{
+#if TA_CHILD_ARRAY
+    if (h_parent->array)
+        return ta_array_prev(h_parent->array, h->index);
+#endif
+
+    struct ta_header *h_prev = h_parent->list;
+    while (h_prev->next != h)
+        h_prev = h_prev->next;
+    return h_prev;
+}
+#endif
+
+static __ta_inline
+void ta_header_link(struct ta_header *restrict h, struct ta_header *restrict h_parent)
+{
+    struct ta_header *h_first = h_parent->list;
+
+#if TA_BACKLINKS
+    if (h_first) {
+        h->prev = h_first->prev;
+        h->next = h_first;
+        h_first->prev = h;
+    } else {
+        h->prev = h;
+        h->next = NULL;
+    }
+#else
+    h->next = h_first;
+#endif
+
+    h->parent = h_parent;
+    h_parent->list = h;
+    ta_header_add_count(h_parent, 1);
+
+#if TA_CHILD_ARRAY
+    if (h_parent->array) {
+        ta_array_push(h_parent, h);
+    } else if (ta_header_get_count(h_parent) > TA_ARRAY_MIN) {
+        ta_array_rebuild(h_parent, 0);
+    }
+#endif
+#if TA_NAMES
+    if (h_parent->names && h->name)
+        ta_names_insert(h_parent, h);
+#endif
+}
+
+static __ta_inline
+void ta_header_unlink(struct ta_header *h)
+{
+    struct ta_header *h_parent = h->parent;
+
+    if (__ta_unlikely(h->size & TA_SIZE_MARKED))
+        ta_header_pass_marks(h, h);
+
+#if TA_BACKLINKS
+    if (h->next) {
+        h->next->prev = h->prev;
+    } else if (h_parent->list != h) {
+        h_parent->list->prev = h->prev;
+    }
+
+    if (h_parent->list == h) {
+        h_parent->list = h->next;
+    } else {
+        h->prev->next = h->next;
+    }
+#else
+    if (h_parent->list == h) {
+        h_parent->list = h->next;
+    } else {
+        ta_header_find_prev(h_parent, h)->next = h->next;
+    }
+#endif
+
+    ta_header_sub_count(h_parent, 1);
+
+#if TA_CHILD_ARRAY
+    if (h_parent->array)
+        ta_array_remove(h_parent, h);
+#endif
+#if TA_NAMES
+    if (h_parent->names) {
+        if (ta_header_get_count(h_parent) < TA_NAMES_MIN / 2) {
+            ta_names_drop(h_parent);
+        } else if (h->name) {
+            ta_names_remove(h_parent, h);
+        }
+    }
+#endif
+}
+
+// Unlinks `count` adjacent siblings from `h_first` to `h_last` with one splice.
+// Indexed parents take them out of their index one by one.
+static void ta_header_unlink_run(struct ta_header *h_first, struct ta_header *h_last,
+                                 size_t count)
+{
+    struct ta_header *h_parent = h_first->parent;
+
+    if (ta_header_has_index(h_parent)) {
+        struct ta_header *h_next = h_last->next;
+        for (struct ta_header *h = h_first; h != h_next;) {
+            struct ta_header *h_unlink = h;
+            h = h->next;
+            ta_header_unlink(h_unlink);
+        }
+        return;
+    }
+
+    struct ta_header *h_after = h_last->next;
+
+#if TA_BACKLINKS
+    struct ta_header *h_before = h_parent->list == h_first ? NULL : h_first->prev;
+
+    if (h_after) {
+        h_after->prev = h_before ? h_before : h_first->prev;
+    } else if (h_before) {
+        h_parent->list->prev = h_before;
+    }
+#else
+    struct ta_header *h_before = h_parent->list == h_first
+                                 ? NULL
+                                 : ta_header_find_prev(h_parent, h_first);
+#endif
+
+    if (h_before) {
+        h_before->next = h_after;
+    } else {
+        h_parent->list = h_after;
+    }
+
+    ta_header_sub_count(h_parent, count);
+}
+
+#if TA_ANCESTRY
+// Labels `h` from its parent (Myers' skew-binary jump pointers): the jump
+// distances along any path are 1, 1, 3, 1, 1, 3, 7, ... so chained jumps double.
+static __ta_inline
+void ta_ancestry_set(struct ta_header *h)
+{
+    struct ta_header *h_parent = h->parent;
+
+    if (!h_parent) {
+        h->jump = h;
+        h->depth = 0;
+        return;
+    }
+
+    struct ta_header *h_jump = h_parent->jump;
+    h->depth = h_parent->depth + 1;
+    h->jump = h_parent->depth - h_jump->depth == h_jump->depth - h_jump->jump->depth
+              ? h_jump->jump
+              : h_parent;
+}
+
+// Relabels the subtree below and including `h_root` top down without recursion.
+static void ta_ancestry_update(struct ta_header *h_root)
+{
+    struct ta_header *h = h_root;
+
+    for (;;) {
+        ta_ancestry_set(h);
+
+        if (h->list) {
+            h = h->list;
+            continue;
+        }
+
+        while (h != h_root && !h->next)
+            h = h->parent;
+
+        if (h == h_root)
+            return;
+
+        h = h->next;
+    }
+}
+#endif
+
+static __ta_inline __ta_nodiscard __ta_returns_nonnull
+void *ta_header_init(struct ta_header *restrict h, const struct ta_allocator *allocator,
+                     size_t size, struct ta_header *restrict h_parent)
+{
+    *h = (struct ta_header) {
+#if TA_MAGIC
+        .magic  = TA_MAGIC,
+#endif
+#if TA_OUTLINE
+        .ptr    = h->ptr,
+#endif
+        // Branchless, so that GCC keeps storing the header field by field.
+        .size   = size | (allocator ? TA_SIZE_ALLOCATOR : 0),
+    };
+
+#if TA_OUTLINE
+    ta_map_put(&ta_header_map, (struct ta_map_entry) {
+        .key          = (uintptr_t)h->ptr,
+        .value.header = h,
+    });
+#endif
+
+    if (h_parent)
+        ta_header_link(h, h_parent);
+
+#if TA_ANCESTRY
+    ta_ancestry_set(h);
+#endif
+
+    return TA_PTR_FROM_HDR(h);
+}
+
+static __ta_inline
+void ta_header_destroy(struct ta_header *h)
+{
+    ta_destructor destructor = ta_header_get_destructor(h);
+    if (destructor) {
+        destructor(TA_PTR_FROM_HDR(h));
+        ta_header_set_destructor(h, NULL);
+    }
+}
+
+// The chunks handed to the callbacks of the running ta_walk() calls of this
+// thread, innermost first. A callback that frees its chunk turns the walk away
+// from the children.
+struct ta_walk_scope {
+    const struct ta_header *header;
+    bool freed;
+    struct ta_walk_scope *outer;
+};
+
+static __ta_thread_local struct ta_walk_scope *ta_walk_scope;
+
+static void ta_walk_release(const struct ta_header *h)
+{
+    for (struct ta_walk_scope *s = ta_walk_scope; s; s = s->outer) {
+        if (s->header == h)
+            s->freed = true;
+    }
+}
+
+static __ta_inline
+void ta_header_release(struct ta_header *h)
+{
+    if (__ta_unlikely(ta_walk_scope))
+        ta_walk_release(h);
+    if (__ta_unlikely(h->size & TA_SIZE_MARKED))
+        ta_header_clear_mark(h);
+
+#if TA_MAGIC
+    h->magic = 0;
+#endif
+#if TA_CHILD_ARRAY
+    ta_array_drop(h);
+#endif
+#if TA_NAMES
+    free(h->name);
+    free(h->names);
+#endif
+    const struct ta_allocator *allocator = ta_header_get_allocator(h);
+    struct ta_align a = ta_header_get_align(h);
+    size_t size = TA_ALIGN_SPAN(a.align) + TA_BLOCK_SIZE(ta_header_get_size(h));
+
+#if TA_OUTLINE
+    ta_header_forget(h);
+    ta_block_free(allocator, (uint8_t *)h->ptr - a.pad, size);
+    h->ptr = NULL;
+
+    ta_spin_lock(&ta_header_pool.lock);
+    h->next = ta_header_pool.free;
+    ta_header_pool.free = h;
+    ta_spin_unlock(&ta_header_pool.lock);
+#else
+    ta_block_free(allocator, (uint8_t *)h - a.pad, size);
+#endif
+}
+
+// Frees the subtree below `h_root`, which has no destructors. Nothing can
+// observe these chunks anymore, so only the head of each list is maintained.
+static void ta_header_free_plain(struct ta_header *h_root)
+{
+    struct ta_header *h = h_root;
+
+    while (h->list) {
+        do {
+            h = h->list;
+            __ta_prefetch(h->next);
+        } while (h->list);
+
+        do {
+            struct ta_header *h_parent = h->parent;
+            h_parent->list = h->next;
+            ta_header_release(h);
+            h = h_parent;
+        } while (h != h_root && !h->list);
+    }
+
+    ta_header_clear_count(h_root);
+
+#if TA_CHILD_ARRAY
+    ta_array_drop(h_root);
+#endif
+#if TA_NAMES
+    ta_names_drop(h_root);
+#endif
+}
+
+// Frees the whole subtree below `h_root` without recursion: destructors run on
+// the way down, chunks are freed on the way back up through parent pointers.
+// Subtrees without destructors are handed over to ta_header_free_plain().
+static void ta_header_free_children(struct ta_header *h_root)
+{
+    struct ta_header *h = h_root;
+
+    while (h->list) {
+        do {
+            if (!ta_header_has_destructors(h)) {
+                ta_header_free_plain(h);
+                break;
+            }
+
+            // Doomed children are popped from the list one by one.
+#if TA_CHILD_ARRAY
+            ta_array_drop(h);
+#endif
+#if TA_NAMES
+            ta_names_drop(h);
+#endif
+            h = h->list;
+            __ta_prefetch(h->next);
+            ta_header_destroy(h);
+        } while (h->list);
+
+        while (h != h_root && !h->list) {
+            struct ta_header *h_parent = h->parent;
+
+            // A doomed chunk is normally the first child, so popping it only
+            // needs the head and the tail link of the next sibling updated.
+            if (__ta_likely(h_parent->list == h && !ta_header_has_index(h_parent))) {
+                h_parent->list = h->next;
+                ta_header_sub_count(h_parent, 1);
+#if TA_BACKLINKS
+                if (h->next)
+                    h->next->prev = h->prev;
+#endif
+            } else {
+                ta_header_unlink(h);
+            }
+
+            ta_header_release(h);
+            h = h_parent;
+        }
+    }
+}
+
+static void ta_header_free(struct ta_header *h)
+{
+    ta_header_destroy(h);
+    ta_header_free_children(h);
+
+    if (h->parent)
+        ta_header_unlink(h);
+
+    ta_header_release(h);
+}
+
+// Resizes the block of a chunk to `size` bytes and aligns the chunk to `align`, or
+// makes it a plain one with 0, and returns its new front.
+static __ta_inline __ta_nodiscard __ta_returns_nonnull
+void *ta_header_move_block(struct ta_header *h, const struct ta_allocator *old,
+                           const struct ta_allocator *allocator, size_t align, size_t size)
+{
+    size_t old_size = TA_BLOCK_SIZE(ta_header_get_size(h));
+    uint8_t *front = ta_header_front(h);
+
+    if (__ta_likely(!(h->size & TA_SIZE_ALIGNED) && !align))
+        return ta_block_realloc(old, allocator, front, old_size, TA_BLOCK_SIZE(size));
+
+    struct ta_align a = ta_header_get_align(h);
+    size_t keep = TA_BLOCK_SIZE(size) < old_size ? TA_BLOCK_SIZE(size) : old_size;
+    size = TA_ALIGN_SPAN(align) + TA_BLOCK_SIZE(size);
+
+    uint8_t *block = front - a.pad;
+
+    // The chunk has to stay within what survives a shrinking block.
+    if (a.pad + keep > size) {
+        memmove(block, front, keep);
+        a.pad = 0;
+    }
+
+    block = (uint8_t *)ta_block_realloc(old, allocator, block,
+                                        TA_ALIGN_SPAN(a.align) + old_size, size);
+    if (!align)
+        return memmove(block, block + a.pad, keep);
+
+    size_t pad = ta_align_pad(block, align);
+    memmove(block + pad, block + a.pad, keep);
+    return ta_align_front(block, align, pad);
+}
+
+// Resizes the block of a chunk, also moving it to `allocator` if it is another one
+// and aligning it to `align` if that is not 0.
+static __ta_inline __ta_nodiscard __ta_returns_nonnull
+void *ta_header_resize(struct ta_header *h, const struct ta_allocator *allocator,
+                       size_t align, size_t size)
+{
+    const struct ta_allocator *old = ta_header_get_allocator(h);
+    size_t flags = (allocator ? TA_SIZE_ALLOCATOR : 0) | (align ? TA_SIZE_ALIGNED : 0);
+
+#if TA_OUTLINE
+    // Only the payload moves, the header and its links stay in place.
+    ta_header_forget(h);
+    void *ptr = ta_header_move_block(h, old, allocator, align, size);
+
+    h->ptr = ptr;
+    h->size = (h->size & ~(TA_SIZE_ALLOCATOR | TA_SIZE_ALIGNED)) | flags;
+    ta_header_set_size(h, size);
+    ta_map_put(&ta_header_map, (struct ta_map_entry) {
+        .key          = (uintptr_t)ptr,
+        .value.header = h,
+    });
+
+    return TA_PTR_FROM_HDR(h);
+#else
+    struct ta_header *h_old = h;
+#if TA_COMPACT
+    // The destructor table is keyed by header address.
+    ta_destructor destructor = ta_header_get_destructor(h);
+    ta_header_set_destructor(h, NULL);
+#endif
+#if TA_NAMES
+    // The index of the parent refers to the chunk by address.
+    bool named = h->name && h->parent && h->parent->names;
+    if (named)
+        ta_names_remove(h->parent, h);
+#endif
+#if !TA_BACKLINKS
+    // The sibling linking to the chunk is found while it is still in place.
+    struct ta_header *h_prev = h->parent && h->parent->list != h
+                               ? ta_header_find_prev(h->parent, h)
+                               : NULL;
+#endif
+
+    h = (struct ta_header *)ta_header_move_block(h, old, allocator, align, size);
+
+    h->size = (h->size & ~(TA_SIZE_ALLOCATOR | TA_SIZE_ALIGNED)) | flags;
+    ta_header_set_size(h, size);
+#if TA_COMPACT
+    ta_header_set_destructor(h, destructor);
+#endif
+
+    if (h != h_old) {
+        for (struct ta_header *h_child = h->list; h_child; h_child = h_child->next)
+            h_child->parent = h;
+
+        struct ta_header *h_parent = h->parent;
+        if (h_parent) {
+#if TA_BACKLINKS
+            if (h_parent->list == h_old) {
+                h_parent->list = h;
+            } else {
+                h->prev->next = h;
+            }
+            if (h->next) {
+                h->next->prev = h;
+            } else if (h_parent->list != h) {
+                h_parent->list->prev = h;
+            } else {
+                h->prev = h;
+            }
+#else
+            if (h_prev) {
+                h_prev->next = h;
+            } else {
+                h_parent->list = h;
+            }
+#endif
+#if TA_CHILD_ARRAY
+            if (h_parent->array)
+                h_parent->array->items[h->index] = h;
+#endif
+        }
+
+#if TA_ANCESTRY
+        // Descendants may jump to the old address.
+        ta_ancestry_update(h);
+#endif
+
+        // So is the mark table.
+        if (__ta_unlikely(h->size & TA_SIZE_MARKED)) {
+            size_t mark = ta_map_get(&ta_mark_map, (uintptr_t)h_old).value.mark;
+            ta_map_del(&ta_mark_map, (uintptr_t)h_old);
+            ta_header_set_mark(h, mark);
+        }
+    }
+
+#if TA_NAMES
+    if (named)
+        ta_names_put(h->parent->names, ta_name_hash(h->name), h);
+#endif
+
+    return TA_PTR_FROM_HDR(h);
+#endif
+}
+
+// Resizes the block of a chunk and moves it to `allocator`, keeping its alignment.
+static __ta_inline __ta_nodiscard __ta_returns_nonnull
+void *ta_header_move(struct ta_header *h, const struct ta_allocator *allocator, size_t size)
+{
+    return ta_header_resize(h, allocator, ta_header_get_align(h).align, size);
+}
+
+static __ta_inline __ta_nodiscard __ta_returns_nonnull
+void *ta_header_realloc(struct ta_header *h, size_t size)
+{
+    return ta_header_move(h, ta_header_get_allocator(h), size);
+}
+
+static __ta_inline __ta_nodiscard __ta_returns_nonnull
+char *ta_header_append(struct ta_header *restrict h, size_t at,
+                       const char *restrict append, size_t len)
+{
+    size_t size = ta_header_get_size(h);
+
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(size < at))
+        abort();
+
+    if (__ta_unlikely(len >= TA_MAX_SIZE || at >= TA_MAX_SIZE - len))
+        abort();
+    // GCOVR_EXCL_STOP
+
+    char *str = size <= at + len
+                ? (char *)ta_header_realloc(h, at + len + 1)
+                : (char *)TA_PTR_FROM_HDR(h);
+
+    if (__ta_likely(len))
+        memcpy(str + at, append, len);
+
+    str[at + len] = '\0';
+    return str;
+}
+
+static __ta_nodiscard __ta_returns_nonnull __ta_printf(3, 0)
+char *ta_header_printf(struct ta_header *restrict h, size_t at,
+                       const char *restrict format, va_list ap)
+{
+    size_t size = ta_header_get_size(h);
+
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(size < at))
+        abort();
+    // GCOVR_EXCL_STOP
+
+    va_list copy;
+    va_copy(copy, ap);
+    int len = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(len < 0))
+        abort();
+
+    if (__ta_unlikely((size_t)len >= TA_MAX_SIZE || at >= TA_MAX_SIZE - (size_t)len))
+        abort();
+    // GCOVR_EXCL_STOP
+
+    char *str = size <= at + (size_t)len
+                ? (char *)ta_header_realloc(h, at + (size_t)len + 1)
+                : (char *)TA_PTR_FROM_HDR(h);
+
+    int res = vsnprintf(str + at, (size_t)len + 1, format, ap);
+
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(res != len))
+        abort();
+    // GCOVR_EXCL_STOP
+
+    return str;
+}
+
+static __ta_inline
+void ta_header_set_parent(struct ta_header *restrict h,
+                          struct ta_header *restrict h_parent)
+{
+    struct ta_header *h_old_parent = h->parent;
+
+    if (h_old_parent) {
+        if (h_old_parent == h_parent && h_parent->list == h)
+            return;
+        ta_header_unlink(h);
+    }
+
+    if (h_parent) {
+        ta_header_link(h, h_parent);
+        if (ta_header_has_destructors(h))
+            ta_header_mark_destructors(h_parent);
+    } else {
+        h->parent = h->next = NULL;
+#if TA_BACKLINKS
+        h->prev = NULL;
+#endif
+    }
+
+#if TA_ANCESTRY
+    if (h_parent != h_old_parent)
+        ta_ancestry_update(h);
+#else
+    (void)h_old_parent;
+#endif
+}
+
+// The chunk is the root of an arena, whose blocks are released with it.
+static __ta_inline __ta_nodiscard
+bool ta_header_is_arena(const struct ta_header *h)
+{
+    struct ta_arena *arena = ta_arena_from_allocator(ta_header_get_allocator(h));
+    return arena && arena->root == ta_header_block(h);
+}
+
+void *ta_xmalloc(size_t size)
+{
+    if (__ta_unlikely(!size))
+        size = 1;
+
+    void *ptr = malloc(size);
+
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(!ptr))
+        abort();
+    // GCOVR_EXCL_STOP
+
+    return ptr;
+}
+
+void *ta_xcalloc(size_t n, size_t size)
+{
+    if (__ta_unlikely(!n || !size))
+        n = size = 1;
+
+    void *ptr = calloc(n, size);
+
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(!ptr))
+        abort();
+    // GCOVR_EXCL_STOP
+
+    return ptr;
+}
+
+void *ta_xrealloc(void *ptr, size_t size)
+{
+    if (__ta_unlikely(!size))
+        size = 1;
+
+    ptr = ptr ? realloc(ptr, size) : malloc(size);
+
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(!ptr))
+        abort();
+    // GCOVR_EXCL_STOP
+
+    return ptr;
+}
+
+void *ta_xzalloc(size_t size)
+{
+    if (__ta_unlikely(!size))
+        size = 1;
+
+    void *ptr = calloc(1, size);
+
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(!ptr))
+        abort();
+    // GCOVR_EXCL_STOP
+
+    return ptr;
+}
+
+#ifndef _WIN32
+void *ta_xmemalign(size_t alignment, size_t size)
+{
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(!alignment))
+        abort();
+
+    if (__ta_unlikely(alignment % sizeof(void *)))
+        abort();
+
+    if (__ta_unlikely(alignment & (alignment - 1)))
+        abort();
+    // GCOVR_EXCL_STOP
+
+    if (__ta_unlikely(!size))
+        size = 1;
+
+    void *ptr = NULL;
+    int rc = posix_memalign(&ptr, alignment, size);
+
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(rc != 0))
+        abort();
+    // GCOVR_EXCL_STOP
+
+    return ptr;
+}
+#endif
+
+char *ta_xstrdup(const char *str)
+{
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(!str))
+        abort();
+    // GCOVR_EXCL_STOP
+
+    size_t n = strlen(str) + 1;
+    void *ptr = malloc(n);
+
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(!ptr))
+        abort();
+    // GCOVR_EXCL_STOP
+
+    return (char *)memcpy(ptr, str, n);
+}
+
+char *ta_xstrndup(const char *str, size_t n)
 {
     // GCOVR_EXCL_START
-    if (__ta_unlikely((uintptr_t)ptr <= TA_HDR_SIZE))
+    if (__ta_unlikely(!str))
         abort();
     // GCOVR_EXCL_STOP
 
-    struct ta_header *h = TA_HDR_FROM_PTR(ptr);
+    n = strnlen(str, n);
+    char *ptr = (char *)malloc(n + 1);
 
-#if TA_MAGIC
     // GCOVR_EXCL_START
-    if (__ta_unlikely(h->magic != TA_MAGIC))
+    if (__ta_unlikely(!ptr))
         abort();
     // GCOVR_EXCL_STOP
-#endif
 
-    return h;
+    if (__ta_likely(n))
+        memcpy(ptr, str, n);
+
+    ptr[n] = '\0';
+    return ptr;
 }
 
-static __ta_inline __ta_nodiscard __ta_returns_nonnull
-void *ta_header_init(struct ta_header *restrict h, size_t size, void *restrict tactx)
+void *ta_xmemdup(const void *mem, size_t n)
 {
-    *h = (struct ta_header) {
-#if TA_MAGIC
-        .magic  = TA_MAGIC,
-#endif
-        .size   = size,
-    };
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(!mem))
+        abort();
+    // GCOVR_EXCL_STOP
 
-    if (tactx) {
-        struct ta_header *h_parent = ta_header_from_ptr(tactx);
-        if (h_parent->list) {
-            h->next = h_parent->list;
-            h->next->prev = h;
-        }
-        h->prev = h_parent;
-        h->prev->list = h;
-    }
+    if (__ta_unlikely(!n)) {
+        void *ptr = malloc(1);
 
-    return TA_PTR_FROM_HDR(h);
-}
+        // GCOVR_EXCL_START
+        if (__ta_unlikely(!ptr))
+            abort();
+        // GCOVR_EXCL_STOP
 
-static void ta_header_free(struct ta_header *h)
-{
-    if (h->destructor) {
-        h->destructor(TA_PTR_FROM_HDR(h));
-        h->destructor = NULL;
+        return ptr;
     }
 
-    while (h->list)
-        ta_header_free(h->list); // NOLINT(clang-analyzer-unix.Malloc)
+    void *ptr = malloc(n);
 
-    if (h->prev) {
-        if (h->prev->list == h) {
-            h->prev->list = h->next;
-        } else {
-            h->prev->next = h->next;
-        }
-        if (h->next)
-            h->next->prev = h->prev;
-    }
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(!ptr))
+        abort();
+    // GCOVR_EXCL_STOP
 
-#if TA_MAGIC
-    h->magic = 0;
-#endif
-    free(h);
+    return memcpy(ptr, mem, n);
 }
 
-static __ta_inline __ta_nodiscard __ta_returns_nonnull
-void *ta_header_realloc(struct ta_header *h, size_t size)
+char *ta_xasprintf(const char *format, ...)
 {
-    struct ta_header *h_old = h;
+    va_list ap;
+    va_start(ap, format);
+    char *str = ta_xvasprintf(format, ap);
+    va_end(ap);
+    return str;
+}
 
-    h = (struct ta_header *)realloc(h, TA_HDR_SIZE + size);
+char *ta_xvasprintf(const char *format, va_list ap)
+{
+    char *str;
+    int len = vasprintf(&str, format, ap);
 
     // GCOVR_EXCL_START
-    if (__ta_unlikely(!h))
+    if (__ta_unlikely(len < 0))
         abort();
     // GCOVR_EXCL_STOP
 
-    h->size = size;
-
-    if (h != h_old) {
-        if (h->list)
-            h->list->prev = h;
-        if (h->next)
-            h->next->prev = h;
-        if (h->prev) {
-            if (h->prev->list == h_old) {
-                h->prev->list = h;
-            } else {
-                h->prev->next = h;
-            }
-        }
-    }
-
-    return TA_PTR_FROM_HDR(h);
+    return str;
 }
 
-static __ta_inline __ta_nodiscard __ta_returns_nonnull
-char *ta_header_append(struct ta_header *restrict h, size_t at,
-                       const char *restrict append, size_t len)
+void *ta_alloc(void *tactx, size_t size)
 {
     // GCOVR_EXCL_START
-    if (__ta_unlikely(h->size < at))
+    if (__ta_unlikely(size > TA_MAX_SIZE))
         abort();
+    // GCOVR_EXCL_STOP
 
-    if (__ta_unlikely(len >= TA_MAX_SIZE || at >= TA_MAX_SIZE - len))
+    struct ta_header *h_parent = tactx ? ta_header_from_ptr(tactx) : NULL;
+    const struct ta_allocator *allocator = ta_header_inherit(h_parent);
+    struct ta_header *h = ta_header_alloc(allocator, size, false);
+
+    return ta_header_init(h, allocator, size, h_parent);
+}
+
+void *ta_zalloc(void *tactx, size_t size)
+{
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(size > TA_MAX_SIZE))
         abort();
     // GCOVR_EXCL_STOP
 
-    char *str = h->size <= at + len
-                ? (char *)ta_header_realloc(h, at + len + 1)
-                : (char *)TA_PTR_FROM_HDR(h);
-
-    if (__ta_likely(len))
-        memcpy(str + at, append, len);
+    struct ta_header *h_parent = tactx ? ta_header_from_ptr(tactx) : NULL;
+    const struct ta_allocator *allocator = ta_header_inherit(h_parent);
+    struct ta_header *h = ta_header_alloc(allocator, size, true);
 
-    str[at + len] = '\0';
-    return str;
+    return ta_header_init(h, allocator, size, h_parent);
 }
 
-static __ta_nodiscard __ta_returns_nonnull __ta_printf(3, 0)
-char *ta_header_printf(struct ta_header *restrict h, size_t at,
-                       const char *restrict format, va_list ap)
+void *ta_realloc(void *restrict tactx, void *restrict ptr, size_t size)
 {
+    if (!ptr)
+        return ta_alloc(tactx, size);
+
     // GCOVR_EXCL_START
-    if (__ta_unlikely(h->size < at))
+    if (__ta_unlikely(size > TA_MAX_SIZE))
         abort();
     // GCOVR_EXCL_STOP
 
-    va_list copy;
-    va_copy(copy, ap);
-    int len = vsnprintf(NULL, 0, format, copy);
-    va_end(copy);
+    struct ta_header *h = ta_header_from_ptr(ptr);
+    ptr = ta_header_realloc(h, size);
+    return ta_set_parent(ptr, tactx);
+}
 
+void *ta_memdup(void *restrict tactx, const void *restrict ptr, size_t size)
+{
     // GCOVR_EXCL_START
-    if (__ta_unlikely(len < 0))
+    if (__ta_unlikely(!ptr))
         abort();
 
-    if (__ta_unlikely((size_t)len >= TA_MAX_SIZE || at >= TA_MAX_SIZE - (size_t)len))
+    if (__ta_unlikely(size > TA_MAX_SIZE))
         abort();
     // GCOVR_EXCL_STOP
 
-    char *str = h->size <= at + (size_t)len
-                ? (char *)ta_header_realloc(h, at + (size_t)len + 1)
-                : (char *)TA_PTR_FROM_HDR(h);
+    struct ta_header *h_parent = tactx ? ta_header_from_ptr(tactx) : NULL;
+    const struct ta_allocator *allocator = ta_header_inherit(h_parent);
+    struct ta_header *h = ta_header_alloc(allocator, size, false);
 
-    int res = vsnprintf(str + at, (size_t)len + 1, format, ap);
+    if (__ta_likely(size))
+        memcpy(TA_PTR_FROM_HDR(h), ptr, size);
+
+    return ta_header_init(h, allocator, size, h_parent);
+}
+
+void *ta_assign(void *restrict tactx, void *restrict ptr, size_t size)
+{
+    if (!ptr)
+        return ta_alloc(tactx, size);
 
     // GCOVR_EXCL_START
-    if (__ta_unlikely(res != len))
+    if (__ta_unlikely(size > TA_MAX_SIZE))
         abort();
     // GCOVR_EXCL_STOP
 
-    return str;
-}
+    struct ta_header *h_parent = tactx ? ta_header_from_ptr(tactx) : NULL;
+    const struct ta_allocator *allocator = ta_header_inherit(h_parent);
 
-static __ta_inline
-void ta_header_set_parent(struct ta_header *restrict h,
-                          struct ta_header *restrict h_parent)
-{
-    if (h->prev) {
-        if (h->prev->list == h) {
-            if (h->prev == h_parent)
-                return;
-            h->prev->list = h->next;
-        } else {
-            h->prev->next = h->next;
-        }
-        if (h->next)
-            h->next->prev = h->prev;
-    }
+    // The buffer itself becomes the block where possible.
+    ptr = ta_block_adopt(allocator, ptr, size, TA_BLOCK_SIZE(size));
 
-    if (h_parent) {
-        if (h_parent->list) {
-            h->next = h_parent->list;
-            h->next->prev = h;
-        } else {
-            h->next = NULL;
-        }
-        h->prev = h_parent;
-        h->prev->list = h;
-    } else {
-        h->prev = h->next = NULL;
-    }
+#if TA_OUTLINE
+    struct ta_header *h = ta_header_attach(ptr);
+#else
+    struct ta_header *h = (struct ta_header *)ptr;
+    if (__ta_likely(size))
+        memmove(TA_PTR_FROM_HDR(h), h, size);
+#endif
+
+    return ta_header_init(h, allocator, size, h_parent);
 }
 
-void *ta_xmalloc(size_t size)
+static __ta_inline __ta_nodiscard
+size_t ta_get_array_size(size_t size, size_t count)
 {
-    if (__ta_unlikely(!size))
-        size = 1;
-
-    void *ptr = malloc(size);
-
     // GCOVR_EXCL_START
-    if (__ta_unlikely(!ptr))
+    if (__ta_unlikely(!size || count > TA_MAX_SIZE / size))
         abort();
     // GCOVR_EXCL_STOP
 
-    return ptr;
+    return size * count;
 }
 
-void *ta_xcalloc(size_t n, size_t size)
+void *ta_alloc_array(void *restrict tactx, size_t size, size_t count)
 {
-    if (__ta_unlikely(!n || !size))
-        n = size = 1;
-
-    void *ptr = calloc(n, size);
+    return ta_alloc(tactx, ta_get_array_size(size, count));
+}
 
-    // GCOVR_EXCL_START
-    if (__ta_unlikely(!ptr))
-        abort();
-    // GCOVR_EXCL_STOP
+void *ta_zalloc_array(void *restrict tactx, size_t size, size_t count)
+{
+    return ta_zalloc(tactx, ta_get_array_size(size, count));
+}
 
-    return ptr;
+void *ta_realloc_array(void *restrict tactx, void *restrict ptr, size_t size, size_t count)
+{
+    return ta_realloc(tactx, ptr, ta_get_array_size(size, count));
 }
 
-void *ta_xrealloc(void *ptr, size_t size)
+void *ta_memdup_array(void *restrict tactx, const void *restrict ptr, size_t size, size_t count)
 {
-    if (__ta_unlikely(!size))
-        size = 1;
+    return ta_memdup(tactx, ptr, ta_get_array_size(size, count));
+}
 
-    ptr = ptr ? realloc(ptr, size) : malloc(size);
+void *ta_assign_array(void *restrict tactx, void *restrict ptr, size_t size, size_t count)
+{
+    return ta_assign(tactx, ptr, ta_get_array_size(size, count));
+}
 
+// Checks the alignment of a chunk and returns it, or 0 if a plain chunk has it.
+static __ta_inline __ta_nodiscard
+size_t ta_get_alignment(size_t alignment, size_t size)
+{
     // GCOVR_EXCL_START
-    if (__ta_unlikely(!ptr))
+    if (__ta_unlikely(alignment < sizeof(void *) || (alignment & (alignment - 1))))
+        abort();
+
+    if (__ta_unlikely(alignment > TA_MAX_SIZE / 2 || size > TA_MAX_SIZE - TA_ALIGN_SPAN(alignment)))
         abort();
     // GCOVR_EXCL_STOP
 
-    return ptr;
+    return alignment <= TA_BLOCK_ALIGN && TA_HDR_SIZE % alignment == 0 ? 0 : alignment;
 }
 
-void *ta_xzalloc(size_t size)
+static __ta_nodiscard __ta_returns_nonnull
+void *ta_alloc_aligned_chunk(void *tactx, size_t alignment, size_t size, bool zero)
 {
-    if (__ta_unlikely(!size))
-        size = 1;
-
-    void *ptr = calloc(1, size);
+    size_t align = ta_get_alignment(alignment, size);
+    if (!align)
+        return zero ? ta_zalloc(tactx, size) : ta_alloc(tactx, size);
 
-    // GCOVR_EXCL_START
-    if (__ta_unlikely(!ptr))
-        abort();
-    // GCOVR_EXCL_STOP
+    struct ta_header *h_parent = tactx ? ta_header_from_ptr(tactx) : NULL;
+    const struct ta_allocator *allocator = ta_header_inherit(h_parent);
+    struct ta_header *h = ta_header_alloc_aligned(allocator, align, size, zero);
+    void *ptr = ta_header_init(h, allocator, size, h_parent);
 
+    h->size |= TA_SIZE_ALIGNED;
     return ptr;
 }
 
-#ifndef _WIN32
-void *ta_xmemalign(size_t alignment, size_t size)
+void *ta_alloc_aligned(void *tactx, size_t alignment, size_t size)
 {
-    // GCOVR_EXCL_START
-    if (__ta_unlikely(!alignment))
-        abort();
+    return ta_alloc_aligned_chunk(tactx, alignment, size, false);
+}
 
-    if (__ta_unlikely(alignment % sizeof(void *)))
-        abort();
+void *ta_zalloc_aligned(void *tactx, size_t alignment, size_t size)
+{
+    return ta_alloc_aligned_chunk(tactx, alignment, size, true);
+}
 
-    if (__ta_unlikely(alignment & (alignment - 1)))
+void *ta_realloc_aligned(void *restrict tactx, void *restrict ptr, size_t alignment, size_t size)
+{
+    if (!ptr)
+        return ta_alloc_aligned(tactx, alignment, size);
+
+    size_t align = ta_get_alignment(alignment, size);
+    struct ta_header *h = ta_header_from_ptr(ptr);
+    ptr = ta_header_resize(h, ta_header_get_allocator(h), align, size);
+    return ta_set_parent(ptr, tactx);
+}
+
+void *ta_alloc_array_aligned(void *restrict tactx, size_t alignment, size_t size, size_t count)
+{
+    return ta_alloc_aligned(tactx, alignment, ta_get_array_size(size, count));
+}
+
+char *ta_strdup(void *restrict tactx, const char *restrict str)
+{
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(!str))
         abort();
     // GCOVR_EXCL_STOP
 
-    if (__ta_unlikely(!size))
-        size = 1;
-
-    void *ptr = NULL;
-    int rc = posix_memalign(&ptr, alignment, size);
+    size_t n = strlen(str) + 1;
 
     // GCOVR_EXCL_START
-    if (__ta_unlikely(rc != 0))
+    if (__ta_unlikely(n > TA_MAX_SIZE))
         abort();
     // GCOVR_EXCL_STOP
 
-    return ptr;
+    struct ta_header *h_parent = tactx ? ta_header_from_ptr(tactx) : NULL;
+    const struct ta_allocator *allocator = ta_header_inherit(h_parent);
+    struct ta_header *h = ta_header_alloc(allocator, n, false);
+
+    memcpy(TA_PTR_FROM_HDR(h), str, n);
+    return (char *)ta_header_init(h, allocator, n, h_parent);
 }
-#endif
 
-char *ta_xstrdup(const char *str)
+char *ta_strdup_append(char *restrict str, const char *restrict append)
 {
     // GCOVR_EXCL_START
-    if (__ta_unlikely(!str))
+    if (__ta_unlikely(!append))
         abort();
     // GCOVR_EXCL_STOP
 
-    size_t n = strlen(str) + 1;
-    void *ptr = malloc(n);
+    struct ta_header *h = ta_header_from_ptr(str);
+    return (char *)ta_header_append(h, strnlen(str, ta_header_get_size(h)),
+                                    append, strlen(append));
+}
 
+char *ta_strdup_append_buffer(char *restrict str, const char *restrict append)
+{
     // GCOVR_EXCL_START
-    if (__ta_unlikely(!ptr))
+    if (__ta_unlikely(!append))
         abort();
     // GCOVR_EXCL_STOP
 
-    return (char *)memcpy(ptr, str, n);
+    struct ta_header *h = ta_header_from_ptr(str);
+    size_t size = ta_header_get_size(h);
+    return (char *)ta_header_append(h, size ? size - 1 : 0, append, strlen(append));
 }
 
-char *ta_xstrndup(const char *str, size_t n)
+char *ta_strndup(void *restrict tactx, const char *restrict str, size_t n)
 {
     // GCOVR_EXCL_START
     if (__ta_unlikely(!str))
@@ -342,426 +3346,877 @@ char *ta_xstrndup(const char *str, size_t n)
     // GCOVR_EXCL_STOP
 
     n = strnlen(str, n);
-    char *ptr = (char *)malloc(n + 1);
 
     // GCOVR_EXCL_START
-    if (__ta_unlikely(!ptr))
+    if (__ta_unlikely(n >= TA_MAX_SIZE))
         abort();
     // GCOVR_EXCL_STOP
 
+    struct ta_header *h_parent = tactx ? ta_header_from_ptr(tactx) : NULL;
+    const struct ta_allocator *allocator = ta_header_inherit(h_parent);
+    struct ta_header *h = ta_header_alloc(allocator, n + 1, false);
+
+    char *ptr = (char *)TA_PTR_FROM_HDR(h);
     if (__ta_likely(n))
         memcpy(ptr, str, n);
 
     ptr[n] = '\0';
-    return ptr;
+    return (char *)ta_header_init(h, allocator, n + 1, h_parent);
 }
 
-void *ta_xmemdup(const void *mem, size_t n)
+char *ta_strndup_append(char *restrict str, const char *restrict append, size_t n)
 {
     // GCOVR_EXCL_START
-    if (__ta_unlikely(!mem))
+    if (__ta_unlikely(!append))
         abort();
     // GCOVR_EXCL_STOP
 
-    if (__ta_unlikely(!n)) {
-        void *ptr = malloc(1);
-
-        // GCOVR_EXCL_START
-        if (__ta_unlikely(!ptr))
-            abort();
-        // GCOVR_EXCL_STOP
-
-        return ptr;
-    }
-
-    void *ptr = malloc(n);
+    struct ta_header *h = ta_header_from_ptr(str);
+    return (char *)ta_header_append(h, strnlen(str, ta_header_get_size(h)),
+                                    append, strnlen(append, n));
+}
 
+char *ta_strndup_append_buffer(char *restrict str, const char *restrict append, size_t n)
+{
     // GCOVR_EXCL_START
-    if (__ta_unlikely(!ptr))
+    if (__ta_unlikely(!append))
         abort();
     // GCOVR_EXCL_STOP
 
-    return memcpy(ptr, mem, n);
+    struct ta_header *h = ta_header_from_ptr(str);
+    size_t size = ta_header_get_size(h);
+    return (char *)ta_header_append(h, size ? size - 1 : 0, append, strnlen(append, n));
 }
 
-char *ta_xasprintf(const char *format, ...)
+char *ta_asprintf(void *restrict tactx, const char *restrict format, ...)
 {
     va_list ap;
     va_start(ap, format);
-    char *str = ta_xvasprintf(format, ap);
+    char *str = ta_vasprintf(tactx, format, ap);
     va_end(ap);
     return str;
 }
 
-char *ta_xvasprintf(const char *format, va_list ap)
+char *ta_asprintf_append(char *restrict str, const char *restrict format, ...)
 {
-    char *str;
-    int len = vasprintf(&str, format, ap);
-
-    // GCOVR_EXCL_START
-    if (__ta_unlikely(len < 0))
-        abort();
-    // GCOVR_EXCL_STOP
+    va_list ap;
+    va_start(ap, format);
+    str = ta_vasprintf_append(str, format, ap);
+    va_end(ap);
+    return str;
+}
 
+char *ta_asprintf_append_buffer(char *restrict str, const char *restrict format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    str = ta_vasprintf_append_buffer(str, format, ap);
+    va_end(ap);
     return str;
 }
 
-void *ta_alloc(void *tactx, size_t size)
+char *ta_vasprintf(void *restrict tactx, const char *restrict format, va_list ap)
 {
+    va_list copy;
+    va_copy(copy, ap);
+    int len = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+
     // GCOVR_EXCL_START
-    if (__ta_unlikely(size > TA_MAX_SIZE))
+    if (__ta_unlikely(len < 0 || (size_t)len >= TA_MAX_SIZE))
         abort();
     // GCOVR_EXCL_STOP
 
-    struct ta_header *h = (struct ta_header *)malloc(TA_HDR_SIZE + size);
+    struct ta_header *h_parent = tactx ? ta_header_from_ptr(tactx) : NULL;
+    const struct ta_allocator *allocator = ta_header_inherit(h_parent);
+    struct ta_header *h = ta_header_alloc(allocator, (size_t)len + 1, false);
+
+    char *str = (char *)TA_PTR_FROM_HDR(h);
+    int res = vsnprintf(str, (size_t)len + 1, format, ap);
 
     // GCOVR_EXCL_START
-    if (__ta_unlikely(!h))
+    if (__ta_unlikely(res != len))
         abort();
     // GCOVR_EXCL_STOP
 
-    return ta_header_init(h, size, tactx);
+    return (char *)ta_header_init(h, allocator, (size_t)len + 1, h_parent);
 }
 
-void *ta_zalloc(void *tactx, size_t size)
+char *ta_vasprintf_append(char *restrict str, const char *restrict format, va_list ap)
 {
-    // GCOVR_EXCL_START
-    if (__ta_unlikely(size > TA_MAX_SIZE))
-        abort();
-    // GCOVR_EXCL_STOP
-
-    struct ta_header *h = (struct ta_header *)calloc(1, TA_HDR_SIZE + size);
+    struct ta_header *h = ta_header_from_ptr(str);
+    return ta_header_printf(h, strnlen(str, ta_header_get_size(h)), format, ap);
+}
 
-    // GCOVR_EXCL_START
-    if (__ta_unlikely(!h))
-        abort();
-    // GCOVR_EXCL_STOP
+char *ta_vasprintf_append_buffer(char *restrict str, const char *restrict format, va_list ap)
+{
+    struct ta_header *h = ta_header_from_ptr(str);
+    size_t size = ta_header_get_size(h);
+    return ta_header_printf(h, size ? size - 1 : 0, format, ap);
+}
 
-    return ta_header_init(h, size, tactx);
+void ta_free(void *ptr)
+{
+    if (__ta_likely(ptr)) {
+        struct ta_header *h = ta_header_from_ptr(ptr);
+        ta_header_free(h);
+    }
 }
 
-void *ta_realloc(void *restrict tactx, void *restrict ptr, size_t size)
+void ta_free_children(void *ptr)
 {
-    if (!ptr)
-        return ta_alloc(tactx, size);
+    struct ta_header *h = ta_header_from_ptr(ptr);
+    ta_header_free_children(h);
+}
 
+void ta_alloc_many(void *tactx, size_t size, size_t n, void **out)
+{
     // GCOVR_EXCL_START
-    if (__ta_unlikely(size > TA_MAX_SIZE))
+    if (__ta_unlikely(size > TA_MAX_SIZE || (n && !out) ||
+                      n > TA_MAX_SIZE / TA_ARENA_ROUND(TA_BLOCK_PREFIX + TA_BLOCK_SIZE(size))))
         abort();
     // GCOVR_EXCL_STOP
 
-    struct ta_header *h = ta_header_from_ptr(ptr);
-    ptr = ta_header_realloc(h, size);
-    return ta_set_parent(ptr, tactx);
+    struct ta_header *h_parent = tactx ? ta_header_from_ptr(tactx) : NULL;
+    const struct ta_allocator *allocator = ta_header_inherit(h_parent);
+
+    // Chunks that would come from libc one by one are carved from a single block.
+    if (!allocator && n > 1 && !TA_SLAB_FITS(TA_BLOCK_SIZE(size))) {
+        size_t block = TA_ARENA_ROUND(TA_BLOCK_PREFIX + TA_BLOCK_SIZE(size));
+        allocator = &ta_pool_new(n * block, true)->allocator;
+    }
+
+    // The chunks are chained newest first like separate allocations would be,
+    // and the chain is spliced in front of the children of the parent at once.
+    struct ta_header *h_first = NULL, *h_last = NULL;
+    for (size_t i = 0; i < n; ++i) {
+        struct ta_header *h = ta_header_alloc(allocator, size, false);
+        out[i] = ta_header_init(h, allocator, size, NULL);
+
+        if (!h_parent)
+            continue;
+
+        h->parent = h_parent;
+        h->next = h_first;
+#if TA_BACKLINKS
+        if (h_first)
+            h_first->prev = h;
+#endif
+#if TA_CHILD_ARRAY
+        if (h_parent->array)
+            ta_array_push(h_parent, h);
+#endif
+#if TA_ANCESTRY
+        ta_ancestry_set(h);
+#endif
+        h_first = h;
+        h_last = h_last ? h_last : h;
+    }
+
+    if (!h_first)
+        return;
+
+    struct ta_header *h_old = h_parent->list;
+    h_last->next = h_old;
+#if TA_BACKLINKS
+    h_first->prev = h_old ? h_old->prev : h_last;
+    if (h_old)
+        h_old->prev = h_last;
+#endif
+    h_parent->list = h_first;
+    ta_header_add_count(h_parent, n);
+
+#if TA_CHILD_ARRAY
+    if (!h_parent->array && ta_header_get_count(h_parent) > TA_ARRAY_MIN)
+        ta_array_rebuild(h_parent, 0);
+#endif
 }
 
-void *ta_memdup(void *restrict tactx, const void *restrict ptr, size_t size)
+void ta_free_many(void **ptrs, size_t n)
 {
     // GCOVR_EXCL_START
-    if (__ta_unlikely(!ptr))
-        abort();
-
-    if (__ta_unlikely(size > TA_MAX_SIZE))
+    if (__ta_unlikely(n && !ptrs))
         abort();
     // GCOVR_EXCL_STOP
 
-    struct ta_header *h = (struct ta_header *)malloc(TA_HDR_SIZE + size);
+    // Chunks allocated one after another under a parent are linked newest first,
+    // so going backwards finds them as runs of adjacent siblings, which are
+    // unlinked at once. A run of a ta_alloc_many() call pops off the head of the
+    // list and releases in reverse order.
+    for (size_t i = n; i-- > 0;) {
+        if (!ptrs[i])
+            continue;
+
+        struct ta_header *h_first = ta_header_from_ptr(ptrs[i]);
+        struct ta_header *h_last = h_first;
+        size_t count = 1;
+        bool marked = false;
+
+        if (!h_first->parent) {
+            ta_header_free(h_first);
+            continue;
+        }
 
-    // GCOVR_EXCL_START
-    if (__ta_unlikely(!h))
-        abort();
-    // GCOVR_EXCL_STOP
+        // Destructors run while the chunks are still linked, like for ta_free().
+        for (;;) {
+            ta_header_destroy(h_last);
+            if (h_last->list)
+                ta_header_free_children(h_last);
+            marked |= (h_last->size & TA_SIZE_MARKED) != 0;
 
-    if (__ta_likely(size))
-        memcpy(TA_PTR_FROM_HDR(h), ptr, size);
+            if (i == 0 || !h_last->next || TA_PTR_FROM_HDR(h_last->next) != ptrs[i - 1])
+                break;
+
+            h_last = h_last->next;
+            count++;
+            i--;
+        }
 
-    return ta_header_init(h, size, tactx);
+        if (__ta_unlikely(marked))
+            ta_header_pass_marks(h_first, h_last);
+
+        struct ta_header *h_next = h_last->next;
+        ta_header_unlink_run(h_first, h_last, count);
+
+        for (struct ta_header *h = h_first; h != h_next;) {
+            struct ta_header *h_release = h;
+            h = h->next;
+            ta_header_release(h_release);
+        }
+    }
 }
 
-void *ta_assign(void *restrict tactx, void *restrict ptr, size_t size)
+struct ta_mark ta_mark(void *tactx)
 {
-    if (!ptr)
-        return ta_alloc(tactx, size);
+    struct ta_header *h = ta_header_from_ptr(tactx);
+    struct ta_mark mark = {
+        .seq = atomic_fetch_add_explicit(&ta_mark_seq, 1, memory_order_relaxed) + 1,
+    };
 
-    // GCOVR_EXCL_START
-    if (__ta_unlikely(size > TA_MAX_SIZE))
-        abort();
-    // GCOVR_EXCL_STOP
+    // An older mark on the same child ends this one as well.
+    if (h->list && !(h->list->size & TA_SIZE_MARKED))
+        ta_header_set_mark(h->list, mark.seq);
+
+    struct ta_arena *arena = ta_arena_from_allocator(ta_header_get_allocator(h));
+    if (arena) {
+        arena->mark_block = arena->blocks;
+        arena->mark_cur = arena->cur;
+        mark.carved = arena->carved + arena->released;
+        mark.block = arena->blocks;
+        mark.cur = arena->cur;
+    }
 
-    struct ta_header *h = (struct ta_header *)realloc(ptr, TA_HDR_SIZE + size);
+    return mark;
+}
 
-    // GCOVR_EXCL_START
-    if (__ta_unlikely(!h))
-        abort();
-    // GCOVR_EXCL_STOP
+void ta_release_to(void *tactx, struct ta_mark mark)
+{
+    struct ta_header *h = ta_header_from_ptr(tactx);
+
+    // Children are linked newest first, so the ones after the mark lead the list
+    // up to the child that ended it, or the one its mark passed to once it left.
+    // They go in reverse order, which lets an arena rewind its bump pointer.
+    while (h->list && !((h->list->size & TA_SIZE_MARKED) &&
+                        ta_header_get_mark(h->list) <= mark.seq))
+        ta_header_free(h->list);
+
+    // Chunks carved after the mark may be freed out of order, by a grandchild
+    // carved after a later sibling, so the arena is rewound once they are gone.
+    struct ta_arena *arena = ta_arena_from_allocator(ta_header_get_allocator(h));
+    if (arena)
+        ta_arena_rollback(arena, mark);
+}
 
-    if (__ta_likely(size))
-        memmove(TA_PTR_FROM_HDR(h), h, size);
+void ta_move_children(void *restrict src, void *restrict dst)
+{
+    struct ta_header *h_src = ta_header_from_ptr(src);
+    struct ta_header *h_dst = dst ? ta_header_from_ptr(dst) : NULL;
+
+    if (!h_src->list)
+        return;
+
+    if (!h_dst) {
+        do {
+            ta_header_set_parent(h_src->list, NULL);
+        } while (h_src->list);
+        return;
+    }
+
+    // Marks only order the children of the parent they were taken on.
+    bool destructors = false;
+    for (struct ta_header *h = h_src->list; h; h = h->next) {
+        destructors |= ta_header_has_destructors(h);
+        h->parent = h_dst;
+        if (__ta_unlikely(h->size & TA_SIZE_MARKED))
+            ta_header_clear_mark(h);
+    }
+
+    if (destructors)
+        ta_header_mark_destructors(h_dst);
+
+#if TA_ANCESTRY
+    for (struct ta_header *h = h_src->list; h; h = h->next)
+        ta_ancestry_update(h);
+#endif
+
+    struct ta_header *h_first = h_src->list;
+    if (h_dst->list) {
+#if TA_BACKLINKS
+        struct ta_header *h_last = h_dst->list->prev;
+        h_dst->list->prev = h_first->prev;
+        h_last->next = h_first;
+        h_first->prev = h_last;
+#else
+        struct ta_header *h_last = h_dst->list;
+        while (h_last->next)
+            h_last = h_last->next;
+        h_last->next = h_first;
+#endif
+    } else {
+        h_dst->list = h_first;
+    }
+
+    size_t count = ta_header_count_children(h_src);
+    h_src->list = NULL;
+    ta_header_clear_count(h_src);
+    ta_header_add_count(h_dst, count);
+
+#if TA_NAMES
+    ta_names_drop(h_src);
+    for (struct ta_header *h = h_first; h_dst->names && h; h = h->next) {
+        if (h->name)
+            ta_names_insert(h_dst, h);
+    }
+#endif
 
-    return ta_header_init(h, size, tactx);
+#if TA_CHILD_ARRAY
+    // The moved children become the last ones, so they go in front of the array.
+    ta_array_drop(h_src);
+
+    if (h_dst->array) {
+        if (h_dst->array->begin < count)
+            ta_array_rebuild(h_dst, count);
+
+        struct ta_array *a = h_dst->array;
+        for (struct ta_header *h = h_first; h; h = h->next) {
+            h->index = --a->begin;
+            a->items[a->begin] = h;
+            if (a->rank)
+                ta_array_rank_add(a, h->index, 1);
+        }
+    } else if (ta_header_get_count(h_dst) > TA_ARRAY_MIN) {
+        ta_array_rebuild(h_dst, 0);
+    }
+#endif
 }
 
-static __ta_inline __ta_nodiscard
-size_t ta_get_array_size(size_t size, size_t count)
+ta_destructor ta_set_destructor(void *restrict ptr, ta_destructor destructor)
 {
+#if !TA_DESTRUCTORS
     // GCOVR_EXCL_START
-    if (__ta_unlikely(!size || count > TA_MAX_SIZE / size))
+    if (__ta_unlikely(destructor))
         abort();
     // GCOVR_EXCL_STOP
+#endif
 
-    return size * count;
+    struct ta_header *h = ta_header_from_ptr(ptr);
+    ta_destructor prev_destructor = ta_header_get_destructor(h);
+    ta_header_set_destructor(h, destructor);
+    if (destructor)
+        ta_header_mark_destructors(h);
+    return prev_destructor;
 }
 
-void *ta_alloc_array(void *restrict tactx, size_t size, size_t count)
+ta_destructor ta_get_destructor(void *ptr)
 {
-    return ta_alloc(tactx, ta_get_array_size(size, count));
+    struct ta_header *h = ta_header_from_ptr(ptr);
+    return ta_header_get_destructor(h);
 }
 
-void *ta_zalloc_array(void *restrict tactx, size_t size, size_t count)
+void *ta_set_allocator(void *ptr, const struct ta_allocator *allocator)
 {
-    return ta_zalloc(tactx, ta_get_array_size(size, count));
-}
+    struct ta_header *h = ta_header_from_ptr(ptr);
 
-void *ta_realloc_array(void *restrict tactx, void *restrict ptr, size_t size, size_t count)
-{
-    return ta_realloc(tactx, ptr, ta_get_array_size(size, count));
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(allocator && (!allocator->alloc || !allocator->release)))
+        abort();
+
+    // The arena chunk is what the blocks of the arena are carved for.
+    if (__ta_unlikely(ta_header_is_arena(h)))
+        abort();
+    // GCOVR_EXCL_STOP
+
+    if (allocator == ta_header_get_allocator(h))
+        return ptr;
+
+    return ta_header_move(h, allocator, ta_header_get_size(h));
 }
 
-void *ta_memdup_array(void *restrict tactx, const void *restrict ptr, size_t size, size_t count)
+const struct ta_allocator *ta_get_allocator(void *ptr)
 {
-    return ta_memdup(tactx, ptr, ta_get_array_size(size, count));
+    struct ta_header *h = ta_header_from_ptr(ptr);
+    return ta_header_get_allocator(h);
 }
 
-void *ta_assign_array(void *restrict tactx, void *restrict ptr, size_t size, size_t count)
+// Places the arena at the start of its first block and allocates its chunk.
+static __ta_nodiscard __ta_returns_nonnull
+void *ta_arena_start(struct ta_arena_block *b, struct ta_header *h_parent, unsigned flags)
 {
-    return ta_assign(tactx, ptr, ta_get_array_size(size, count));
+    b->next = NULL;
+
+    struct ta_arena *arena = (struct ta_arena *)TA_ARENA_DATA(b);
+    *arena = (struct ta_arena) {
+        .allocator = {
+            .alloc   = ta_arena_alloc,
+            .resize  = ta_arena_resize,
+            .release = ta_arena_release,
+            .ctx     = arena,
+        },
+        .blocks = b,
+        .large  = { &arena->large, &arena->large, 0 },
+        .cur    = (uint8_t *)arena + TA_ARENA_ROUND(sizeof(*arena)),
+        .end    = (uint8_t *)b + b->size,
+        .size   = b->size,
+        .flags  = flags,
+    };
+
+    if (arena->size < TA_ARENA_MIN)
+        arena->size = TA_ARENA_MIN;
+
+    struct ta_header *h = ta_header_alloc(&arena->allocator, 0, false);
+    arena->root = ta_header_front(h) - TA_BLOCK_PREFIX;
+    return ta_header_init(h, &arena->allocator, 0, h_parent);
 }
 
-char *ta_strdup(void *restrict tactx, const char *restrict str)
+static __ta_nodiscard __ta_returns_nonnull
+void *ta_arena_create(void *tactx, size_t size, unsigned flags)
 {
     // GCOVR_EXCL_START
-    if (__ta_unlikely(!str))
+    if (__ta_unlikely(size > TA_MAX_SIZE))
         abort();
     // GCOVR_EXCL_STOP
 
-    size_t n = strlen(str) + 1;
+    struct ta_header *h_parent = tactx ? ta_header_from_ptr(tactx) : NULL;
 
-    // GCOVR_EXCL_START
-    if (__ta_unlikely(n > TA_MAX_SIZE))
-        abort();
-    // GCOVR_EXCL_STOP
+    size = size ? size : TA_ARENA_SIZE;
+    size = size < TA_ARENA_MIN ? TA_ARENA_MIN : TA_ARENA_ROUND(size);
 
-    struct ta_header *h = (struct ta_header *)malloc(TA_HDR_SIZE + n);
+    struct ta_arena_block *b = ta_arena_block_new(size, flags);
 
     // GCOVR_EXCL_START
-    if (__ta_unlikely(!h))
+    if (__ta_unlikely(!b))
         abort();
     // GCOVR_EXCL_STOP
 
-    memcpy(TA_PTR_FROM_HDR(h), str, n);
-    return (char *)ta_header_init(h, n, tactx);
+    return ta_arena_start(b, h_parent, flags);
 }
 
-char *ta_strdup_append(char *restrict str, const char *restrict append)
+void *ta_arena_new(void *tactx, size_t size)
 {
-    // GCOVR_EXCL_START
-    if (__ta_unlikely(!append))
-        abort();
-    // GCOVR_EXCL_STOP
-
-    struct ta_header *h = ta_header_from_ptr(str);
-    return (char *)ta_header_append(h, strnlen(str, h->size), append, strlen(append));
+    return ta_arena_create(tactx, size, 0);
 }
 
-char *ta_strdup_append_buffer(char *restrict str, const char *restrict append)
+void *ta_pool(void *tactx, size_t size)
 {
     // GCOVR_EXCL_START
-    if (__ta_unlikely(!append))
+    if (__ta_unlikely(size > TA_MAX_SIZE))
         abort();
     // GCOVR_EXCL_STOP
 
-    struct ta_header *h = ta_header_from_ptr(str);
-    return (char *)ta_header_append(h, h->size ? h->size - 1 : 0, append, strlen(append));
+    struct ta_header *h_parent = tactx ? ta_header_from_ptr(tactx) : NULL;
+
+    // The pool chunk itself is the first one carved from the block.
+    size_t root = TA_ARENA_ROUND(TA_BLOCK_PREFIX + TA_BLOCK_SIZE(0));
+    struct ta_pool *pool = ta_pool_new(root + TA_ARENA_ROUND(size), false);
+
+    struct ta_header *h = ta_header_alloc(&pool->allocator, 0, false);
+    return ta_header_init(h, &pool->allocator, 0, h_parent);
 }
 
-char *ta_strndup(void *restrict tactx, const char *restrict str, size_t n)
+void *ta_context_from_buffer(void *buf, size_t len)
 {
     // GCOVR_EXCL_START
-    if (__ta_unlikely(!str))
+    if (__ta_unlikely(!buf && len))
         abort();
     // GCOVR_EXCL_STOP
 
-    n = strnlen(str, n);
+    uintptr_t start = TA_ARENA_ROUND((uintptr_t)buf);
+    uintptr_t end = (uintptr_t)buf + len;
+    size_t room = end > start ? end - start : 0;
 
-    // GCOVR_EXCL_START
-    if (__ta_unlikely(n >= TA_MAX_SIZE))
-        abort();
-    // GCOVR_EXCL_STOP
+    // A buffer without room for the arena leaves everything to the heap.
+    if (room < TA_ARENA_HEADER + TA_ARENA_ROUND(sizeof(struct ta_arena)))
+        return ta_arena_create(NULL, TA_ARENA_MIN, 0);
 
-    struct ta_header *h = (struct ta_header *)malloc(TA_HDR_SIZE + n + 1);
+    struct ta_arena_block *b = (struct ta_arena_block *)start;
+    b->size = room;
+    return ta_arena_start(b, NULL, TA_ARENA_BUFFER);
+}
 
+#ifndef _WIN32
+void *ta_arena_map(void *tactx, size_t size, unsigned flags)
+{
     // GCOVR_EXCL_START
-    if (__ta_unlikely(!h))
+    if (__ta_unlikely(flags & ~(unsigned)(TA_ARENA_HUGE | TA_ARENA_PREFAULT)))
         abort();
     // GCOVR_EXCL_STOP
 
-    char *ptr = (char *)TA_PTR_FROM_HDR(h);
-    if (__ta_likely(n))
-        memcpy(ptr, str, n);
+    return ta_arena_create(tactx, size, flags | TA_ARENA_MAPPED);
+}
+#endif
 
-    ptr[n] = '\0';
-    return (char *)ta_header_init(h, n + 1, tactx);
+#ifdef __linux__
+// The bytes of the blocks of an arena within a mapping.
+static __ta_nodiscard
+size_t ta_arena_overlap(const struct ta_arena *arena, uintptr_t start, uintptr_t end)
+{
+    const struct ta_arena_block *lists[] = { arena->blocks, arena->spare, arena->large.next };
+    size_t overlap = 0;
+
+    for (size_t i = 0; i < 3; ++i) {
+        for (const struct ta_arena_block *b = lists[i]; b && b != &arena->large; b = b->next) {
+            uintptr_t lo = (uintptr_t)b > start ? (uintptr_t)b : start;
+            uintptr_t hi = (uintptr_t)b + b->size < end ? (uintptr_t)b + b->size : end;
+            if (lo < hi)
+                overlap += hi - lo;
+        }
+    }
+
+    return overlap;
 }
 
-char *ta_strndup_append(char *restrict str, const char *restrict append, size_t n)
+// Splits the resident memory of mapped blocks into huge and regular pages by what
+// the kernel reports for each mapping, in proportion to the share of the blocks in it.
+static void ta_arena_count_pages(const struct ta_arena *arena, struct ta_arena_stats *stats)
 {
-    // GCOVR_EXCL_START
-    if (__ta_unlikely(!append))
-        abort();
-    // GCOVR_EXCL_STOP
+    FILE *f = fopen("/proc/self/smaps", "r");
+    if (!f)
+        return;
 
-    struct ta_header *h = ta_header_from_ptr(str);
-    return (char *)ta_header_append(h, strnlen(str, h->size), append, strnlen(append, n));
+    char line[256];
+    double share = 0;
+    size_t rss = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long start, end;
+        size_t kb;
+
+        if (sscanf(line, "%llx-%llx ", &start, &end) == 2) {
+            size_t overlap = ta_arena_overlap(arena, (uintptr_t)start, (uintptr_t)end);
+            share = (double)overlap / (double)(end - start);
+            rss = 0;
+        } else if (share <= 0) {
+            continue;
+        } else if (sscanf(line, "Rss: %zu kB", &kb) == 1) {
+            rss = kb << 10;
+        } else if (sscanf(line, "AnonHugePages: %zu kB", &kb) == 1) {
+            size_t huge = kb << 10;
+            stats->huge_bytes += (size_t)((double)huge * share);
+            stats->regular_bytes += (size_t)((double)(rss - huge) * share);
+        }
+    }
+
+    fclose(f);
 }
+#endif
 
-char *ta_strndup_append_buffer(char *restrict str, const char *restrict append, size_t n)
+bool ta_get_arena_stats(void *ptr, struct ta_arena_stats *stats)
 {
     // GCOVR_EXCL_START
-    if (__ta_unlikely(!append))
+    if (__ta_unlikely(!stats))
         abort();
     // GCOVR_EXCL_STOP
 
-    struct ta_header *h = ta_header_from_ptr(str);
-    return (char *)ta_header_append(h, h->size ? h->size - 1 : 0, append, strnlen(append, n));
+    struct ta_header *h = ta_header_from_ptr(ptr);
+    *stats = (struct ta_arena_stats){0};
+
+    if (!ta_header_is_arena(h))
+        return false;
+
+    struct ta_arena *arena = ta_arena_from_allocator(ta_header_get_allocator(h));
+    for (struct ta_arena_block *b = arena->blocks; b; b = b->next) {
+        stats->blocks++;
+        stats->bytes += b->size;
+    }
+    for (struct ta_arena_block *b = arena->spare; b; b = b->next) {
+        stats->blocks++;
+        stats->bytes += b->size;
+    }
+    for (struct ta_arena_block *b = arena->large.next; b != &arena->large; b = b->next) {
+        stats->blocks++;
+        stats->bytes += b->size;
+    }
+
+#ifdef __linux__
+    if (arena->flags & TA_ARENA_MAPPED)
+        ta_arena_count_pages(arena, stats);
+#endif
+
+    return true;
 }
 
-char *ta_asprintf(void *restrict tactx, const char *restrict format, ...)
+#ifndef _WIN32
+#ifdef __linux__
+typedef unsigned char ta_mincore_t;
+#else
+typedef char ta_mincore_t;
+#endif
+
+// Returns the whole pages between `from` and `to` to the system, they read back
+// as zeros when touched again. Counts the bytes of those that were resident.
+static size_t ta_arena_discard(uint8_t *from, uint8_t *to)
 {
-    va_list ap;
-    va_start(ap, format);
-    char *str = ta_vasprintf(tactx, format, ap);
-    va_end(ap);
-    return str;
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t lo = ((uintptr_t)from + page - 1) & ~(page - 1);
+    uintptr_t hi = (uintptr_t)to & ~(page - 1);
+    size_t resident = 0;
+
+    if (lo >= hi)
+        return 0;
+
+    ta_mincore_t vec[256];
+    for (uintptr_t p = lo; p < hi; p += sizeof(vec) * page) {
+        size_t len = hi - p < sizeof(vec) * page ? hi - p : sizeof(vec) * page;
+        if (mincore((void *)p, len, vec) != 0)
+            continue; // GCOVR_EXCL_LINE
+
+        for (size_t i = 0; i < len / page; ++i)
+            resident += (vec[i] & 1) ? page : 0;
+    }
+
+    madvise((void *)lo, hi - lo, MADV_DONTNEED);
+    return resident;
 }
+#endif
 
-char *ta_asprintf_append(char *restrict str, const char *restrict format, ...)
+// Once nothing carved from the arena is left but the arena chunk, which takes its
+// children and the chunks moved out of it being freed, large blocks are released,
+// carved blocks beyond the first become spare ones and carving restarts right
+// after the chunk.
+static size_t ta_arena_rewind(struct ta_arena *arena, const struct ta_header *h)
 {
-    va_list ap;
-    va_start(ap, format);
-    str = ta_vasprintf_append(str, format, ap);
-    va_end(ap);
-    return str;
+    struct ta_arena_block *first = arena->blocks;
+    size_t released = 0;
+
+    while (first->next)
+        first = first->next;
+
+    uint8_t *root = (uint8_t *)arena->root;
+    uint8_t *first_end = (uint8_t *)first + first->size;
+
+    if (arena->refs > 1 || root < (uint8_t *)first || root >= first_end)
+        return 0;
+
+    struct ta_arena_block *b = arena->large.next;
+    while (b != &arena->large) {
+        struct ta_arena_block *next = b->next;
+        released += b->size;
+        ta_arena_block_free(b, arena->flags);
+        b = next;
+    }
+    arena->large.next = arena->large.prev = &arena->large;
+
+    b = arena->blocks;
+    while (b != first) {
+        struct ta_arena_block *next = b->next;
+        b->next = arena->spare;
+        arena->spare = b;
+        b = next;
+    }
+    arena->blocks = first;
+
+    size_t size = TA_BLOCK_PREFIX + TA_ALIGN_SPAN(ta_header_get_align(h).align) +
+                  TA_BLOCK_SIZE(ta_header_get_size(h));
+    arena->cur = root + TA_ARENA_ROUND(size);
+    arena->end = first_end;
+    if (arena->mark_block) {
+        arena->mark_block = first;
+        arena->mark_cur = arena->cur;
+    }
+    return released;
 }
 
-char *ta_asprintf_append_buffer(char *restrict str, const char *restrict format, ...)
+// Releases the spare blocks of the arena, and all but its first block once nothing
+// else is carved from it. The untouched pages of the current block go
+// back too.
+static size_t ta_arena_trim(struct ta_arena *arena, const struct ta_header *h)
 {
-    va_list ap;
-    va_start(ap, format);
-    str = ta_vasprintf_append_buffer(str, format, ap);
-    va_end(ap);
-    return str;
+    size_t released = ta_arena_rewind(arena, h) + ta_arena_shed(arena, 0);
+
+    struct ta_arena_block *first = arena->blocks;
+    while (first->next)
+        first = first->next;
+
+#ifndef _WIN32
+    // Pages of a buffer belong to the caller.
+    if (!(arena->flags & TA_ARENA_BUFFER) || arena->blocks != first)
+        released += ta_arena_discard(arena->cur, arena->end);
+#endif
+    return released;
 }
 
-char *ta_vasprintf(void *restrict tactx, const char *restrict format, va_list ap)
+size_t ta_trim(void *tactx)
 {
-    va_list copy;
-    va_copy(copy, ap);
-    int len = vsnprintf(NULL, 0, format, copy);
-    va_end(copy);
+    struct ta_header *h_root = ta_header_from_ptr(tactx);
+    struct ta_header *h = h_root;
+    size_t released = 0;
+
+    for (;;) {
+        // Prefaulted arenas below keep their memory, they are trimmed on their own.
+        if (ta_header_is_arena(h)) {
+            struct ta_arena *arena = ta_arena_from_allocator(ta_header_get_allocator(h));
+            if (h == h_root || !(arena->flags & TA_ARENA_PREFAULT))
+                released += ta_arena_trim(arena, h);
+        }
 
-    // GCOVR_EXCL_START
-    if (__ta_unlikely(len < 0 || (size_t)len >= TA_MAX_SIZE))
-        abort();
-    // GCOVR_EXCL_STOP
+        if (h->list) {
+            h = h->list;
+            continue;
+        }
 
-    struct ta_header *h = (struct ta_header *)malloc(TA_HDR_SIZE + (size_t)len + 1);
+        while (h != h_root && !h->next)
+            h = h->parent;
 
-    // GCOVR_EXCL_START
-    if (__ta_unlikely(!h))
-        abort();
-    // GCOVR_EXCL_STOP
+        if (h == h_root)
+            return released;
 
-    char *str = (char *)TA_PTR_FROM_HDR(h);
-    int res = vsnprintf(str, (size_t)len + 1, format, ap);
+        h = h->next;
+    }
+}
 
-    // GCOVR_EXCL_START
-    if (__ta_unlikely(res != len))
-        abort();
-    // GCOVR_EXCL_STOP
+void ta_reset(void *tactx, size_t retain)
+{
+    struct ta_header *h = ta_header_from_ptr(tactx);
+    ta_header_free_children(h);
 
-    return (char *)ta_header_init(h, (size_t)len + 1, tactx);
+    if (ta_header_is_arena(h)) {
+        struct ta_arena *arena = ta_arena_from_allocator(ta_header_get_allocator(h));
+        ta_arena_rewind(arena, h);
+        ta_arena_shed(arena, retain);
+    }
 }
 
-char *ta_vasprintf_append(char *restrict str, const char *restrict format, va_list ap)
+size_t ta_trim_all(void)
 {
-    struct ta_header *h = ta_header_from_ptr(str);
-    return ta_header_printf(h, strnlen(str, h->size), format, ap);
+    size_t released = 0;
+
+#if TA_CACHE
+    released += ta_cache.bytes;
+    ta_cache_flush();
+#endif
+#if TA_SLAB
+    released += ta_slab_trim();
+#endif
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+
+    return released;
 }
 
-char *ta_vasprintf_append_buffer(char *restrict str, const char *restrict format, va_list ap)
+bool ta_get_cache_stats(struct ta_cache_stats *stats)
 {
-    struct ta_header *h = ta_header_from_ptr(str);
-    return ta_header_printf(h, h->size ? h->size - 1 : 0, format, ap);
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(!stats))
+        abort();
+    // GCOVR_EXCL_STOP
+
+#if TA_CACHE
+    *stats = ta_cache.stats;
+    stats->blocks = 0;
+    for (size_t i = 0; i < TA_CACHE_BINS; ++i)
+        stats->blocks += ta_cache.bins[i].count;
+    stats->bytes = ta_cache.bytes;
+    return true;
+#else
+    *stats = (struct ta_cache_stats){0};
+    return false;
+#endif
 }
 
-void ta_free(void *ptr)
+void ta_flush_cache(void)
 {
-    if (__ta_likely(ptr)) {
-        struct ta_header *h = ta_header_from_ptr(ptr);
-        ta_header_free(h);
-    }
+#if TA_CACHE
+    ta_cache_flush();
+#endif
 }
 
-void ta_free_children(void *ptr)
+const char *ta_set_name(void *restrict ptr, const char *restrict name)
 {
     struct ta_header *h = ta_header_from_ptr(ptr);
-    while (h->list)
-        ta_header_free(h->list); // NOLINT(clang-analyzer-unix.Malloc)
-}
 
-void ta_move_children(void *restrict src, void *restrict dst)
-{
-    struct ta_header *h_src = ta_header_from_ptr(src);
-    struct ta_header *h_dst = dst ? ta_header_from_ptr(dst) : NULL;
+#if TA_NAMES
+    char *copy = name ? ta_xstrdup(name) : NULL;
+    struct ta_header *h_parent = h->parent;
+    bool indexed = h_parent && h_parent->names;
 
-    if (!h_src->list)
-        return;
+    if (indexed && h->name)
+        ta_names_remove(h_parent, h);
 
-    if (!h_dst) {
-        do {
-            ta_header_set_parent(h_src->list, NULL);
-        } while (h_src->list);
-        return;
-    }
+    free(h->name);
+    h->name = copy;
 
-    if (!h_dst->list) {
-        h_dst->list = h_src->list;
-        h_dst->list->prev = h_dst;
-        h_src->list = NULL;
-        return;
-    }
+    if (indexed && h->name)
+        ta_names_insert(h_parent, h);
 
-    struct ta_header *h = h_dst->list;
-    while (h->next)
-        h = h->next;
+    return h->name;
+#else
+    (void)h;
 
-    h->next = h_src->list;
-    h->next->prev = h;
-    h_src->list = NULL;
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(name))
+        abort();
+    // GCOVR_EXCL_STOP
+
+    return NULL;
+#endif
 }
 
-ta_destructor ta_set_destructor(void *restrict ptr, ta_destructor destructor)
+const char *ta_get_name(void *ptr)
 {
     struct ta_header *h = ta_header_from_ptr(ptr);
-    ta_destructor prev_destructor = h->destructor;
-    h->destructor = destructor;
-    return prev_destructor;
+
+#if TA_NAMES
+    return h->name;
+#else
+    (void)h;
+    return NULL;
+#endif
 }
 
-ta_destructor ta_get_destructor(void *ptr)
+void *ta_find_child(void *restrict tactx, const char *restrict name)
 {
-    struct ta_header *h = ta_header_from_ptr(ptr);
-    return h->destructor;
+    // GCOVR_EXCL_START
+    if (__ta_unlikely(!name))
+        abort();
+    // GCOVR_EXCL_STOP
+
+    struct ta_header *h_parent = ta_header_from_ptr(tactx);
+
+#if TA_NAMES
+    if (!h_parent->names && ta_header_get_count(h_parent) >= TA_NAMES_MIN)
+        ta_names_build(h_parent);
+
+    struct ta_names *n = h_parent->names;
+    if (n) {
+        size_t hash = ta_name_hash(name);
+        for (size_t i = hash & n->mask; n->entries[i].header; i = (i + 1) & n->mask) {
+            struct ta_header *h = n->entries[i].header;
+            if (n->entries[i].hash == hash && !strcmp(h->name, name))
+                return TA_PTR_FROM_HDR(h);
+        }
+        return NULL;
+    }
+
+    for (struct ta_header *h = h_parent->list; h; h = h->next) {
+        if (h->name && !strcmp(h->name, name))
+            return TA_PTR_FROM_HDR(h);
+    }
+#else
+    (void)h_parent;
+#endif
+
+    return NULL;
 }
 
 void *ta_set_parent(void *restrict ptr, void *restrict tactx)
@@ -775,25 +4230,29 @@ void *ta_set_parent(void *restrict ptr, void *restrict tactx)
 void *ta_get_parent(void *ptr)
 {
     struct ta_header *h = ta_header_from_ptr(ptr);
-    if (!h->prev)
-        return NULL;
-    while (h->prev->list != h)
-        h = h->prev;
-    return TA_PTR_FROM_HDR(h->prev);
+    return h->parent ? TA_PTR_FROM_HDR(h->parent) : NULL;
 }
 
 static __ta_inline __ta_nodiscard
 bool ta_lookup_parent(struct ta_header *h, struct ta_header *h_parent)
 {
-    do {
-        if (!h->prev)
-            return false;
-        while (h->prev->list != h)
-            h = h->prev;
-        if (h->prev == h_parent)
+#if TA_ANCESTRY
+    // Climbs to the depth of `h_parent`, jumping whenever it does not overshoot.
+    size_t depth = h_parent->depth;
+    if (h->depth <= depth)
+        return false;
+
+    while (h->depth > depth)
+        h = h->jump->depth >= depth ? h->jump : h->parent;
+
+    return h == h_parent;
+#else
+    for (h = h->parent; h; h = h->parent) {
+        if (h == h_parent)
             return true;
-        h = h->prev;
-    } while (true);
+    }
+    return false;
+#endif
 }
 
 bool ta_has_parent(void *ptr, void *tactx)
@@ -824,20 +4283,219 @@ void *ta_get_child(void *ptr)
     return h->list ? TA_PTR_FROM_HDR(h->list) : NULL;
 }
 
+size_t ta_get_child_count(void *ptr)
+{
+    struct ta_header *h = ta_header_from_ptr(ptr);
+    return ta_header_count_children(h);
+}
+
+void *ta_get_child_at(void *ptr, size_t index)
+{
+    struct ta_header *h = ta_header_from_ptr(ptr);
+    size_t count = ta_header_count_children(h);
+
+    if (index >= count)
+        return NULL;
+
+#if TA_CHILD_ARRAY
+    struct ta_array *a = h->array;
+    if (a) {
+        if (!a->holes)
+            return TA_PTR_FROM_HDR(a->items[a->end - 1 - index]);
+
+        // Children are counted from the end of the array.
+        if (!a->rank)
+            ta_array_rank_build(a);
+        return TA_PTR_FROM_HDR(a->items[ta_array_rank_find(a, count - 1 - index)]);
+    }
+#endif
+
+    struct ta_header *h_child = h->list;
+
+#if TA_BACKLINKS
+    // The first child links to the last one, so walk from the nearer end.
+    if (index > count / 2) {
+        for (index = count - index; index; --index)
+            h_child = h_child->prev;
+        return TA_PTR_FROM_HDR(h_child);
+    }
+#endif
+
+    while (index--)
+        h_child = h_child->next;
+    return TA_PTR_FROM_HDR(h_child);
+}
+
+static __ta_inline __ta_nodiscard
+struct ta_header *ta_header_next(const struct ta_header *h)
+{
+#if TA_CHILD_ARRAY
+    if (h->parent && h->parent->array)
+        return ta_array_next(h->parent->array, h->index);
+#endif
+    return h->next;
+}
+
 void *ta_get_next(void *ptr)
 {
     struct ta_header *h = ta_header_from_ptr(ptr);
-    return h->next ? TA_PTR_FROM_HDR(h->next) : NULL;
+    h = ta_header_next(h);
+    return h ? TA_PTR_FROM_HDR(h) : NULL;
 }
 
 void *ta_get_prev(void *ptr)
 {
     struct ta_header *h = ta_header_from_ptr(ptr);
-    return h->prev && h->prev->list != h ? TA_PTR_FROM_HDR(h->prev) : NULL;
+
+#if TA_CHILD_ARRAY
+    if (h->parent && h->parent->array) {
+        h = ta_array_prev(h->parent->array, h->index);
+        return h ? TA_PTR_FROM_HDR(h) : NULL;
+    }
+#endif
+
+    if (!h->parent || h->parent->list == h)
+        return NULL;
+
+#if TA_BACKLINKS
+    return TA_PTR_FROM_HDR(h->prev);
+#else
+    return TA_PTR_FROM_HDR(ta_header_find_prev(h->parent, h));
+#endif
 }
 
 size_t ta_get_size(void *ptr)
 {
     struct ta_header *h = ta_header_from_ptr(ptr);
-    return h->size;
+    return ta_header_get_size(h);
+}
+
+// Enters `h`. Its parent and next sibling are saved up front, so that the
+// caller may free it as long as the walk does not descend into it.
+static __ta_inline __ta_nodiscard __ta_returns_nonnull
+void *ta_walker_enter(struct ta_walker *w, struct ta_header *h)
+{
+    struct ta_header *h_next = w->depth ? ta_header_next(h) : NULL;
+
+    __ta_prefetch(h->list);
+    __ta_prefetch(h_next);
+
+    w->header = h;
+    w->parent = h->parent;
+    w->next = h_next;
+    w->leaving = false;
+    w->skip = false;
+    return w->ptr = TA_PTR_FROM_HDR(h);
+}
+
+void ta_walker_init(struct ta_walker *restrict w, void *restrict tactx, bool post)
+{
+    *w = (struct ta_walker) {
+        .post = post,
+        .root = ta_header_from_ptr(tactx),
+    };
+}
+
+static __ta_inline
+void *ta_walker_step(struct ta_walker *w)
+{
+    struct ta_header *h = (struct ta_header *)w->header;
+
+    if (!h) {
+        h = (struct ta_header *)w->root;
+        if (!h)
+            return NULL;
+        return ta_walker_enter(w, h);
+    }
+
+    if (!w->leaving && !w->skip) {
+        if (h->list) {
+            w->depth++;
+            return ta_walker_enter(w, h->list);
+        }
+        if (w->post) {
+            w->leaving = true;
+            return w->ptr;
+        }
+    }
+
+    // Climbs until a chunk has a next sibling, visiting the parents on the way.
+    while (!w->next) {
+        if (!w->depth) {
+            *w = (struct ta_walker) {0};
+            return NULL;
+        }
+
+        h = (struct ta_header *)w->parent;
+        w->depth--;
+        w->header = h;
+        w->parent = h->parent;
+        w->next = w->depth ? ta_header_next(h) : NULL;
+
+        if (w->post) {
+            w->leaving = true;
+            w->skip = false;
+            return w->ptr = TA_PTR_FROM_HDR(h);
+        }
+    }
+
+    return ta_walker_enter(w, (struct ta_header *)w->next);
+}
+
+void *ta_walker_next(struct ta_walker *w)
+{
+    return ta_walker_step(w);
+}
+
+void ta_walker_skip(struct ta_walker *w)
+{
+    w->skip = true;
+}
+
+bool ta_walk(void *tactx, ta_walk_callback pre, ta_walk_callback post, void *user)
+{
+    struct ta_walker w;
+    ta_walker_init(&w, tactx, post != NULL);
+
+    struct ta_walk_scope scope = { .outer = ta_walk_scope };
+    ta_walk_scope = &scope;
+
+    bool done = true;
+    while (ta_walker_step(&w)) {
+        ta_walk_callback callback = w.leaving ? post : pre;
+        if (!callback)
+            continue;
+
+        scope.header = (const struct ta_header *)w.header;
+        scope.freed = false;
+
+        int ret = callback(w.ptr, w.depth, user);
+        if (ret == TA_WALK_STOP) {
+            done = false;
+            break;
+        }
+        if (ret == TA_WALK_SKIP || scope.freed)
+            w.skip = true;
+    }
+
+    ta_walk_scope = scope.outer;
+    return done;
 }
+
+// Out-of-line headers and child arrays are left to the exported functions.
+const struct ta_layout ta_layout = {
+#if !TA_OUTLINE && !TA_CHILD_ARRAY
+    .header    = TA_HDR_SIZE,
+#endif
+    .parent    = offsetof(struct ta_header, parent),
+    .list      = offsetof(struct ta_header, list),
+#if TA_BACKLINKS
+    .prev      = offsetof(struct ta_header, prev),
+#endif
+    .next      = offsetof(struct ta_header, next),
+    .size      = offsetof(struct ta_header, size),
+    .size_mask = ~TA_SIZE_FLAGS,
+#if !TA_COUNT_BITS
+    .count     = offsetof(struct ta_header, count),
+#endif
+};
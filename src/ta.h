@@ -190,6 +190,12 @@ void *ta_alloc(void *tactx, size_t size);
 __ta_public __ta_nodiscard __ta_returns_nonnull
 void *ta_zalloc(void *tactx, size_t size);
 
+// Create `n` TA chunks of `size` bytes into `out`, as if by as many ta_alloc() calls.
+// Chunks that would each come from libc share one block instead, which is released
+// once all of them are freed. Their children come from libc as usual.
+__ta_public
+void ta_alloc_many(void *tactx, size_t size, size_t n, void **out);
+
 // Change the size of a TA chunk.
 __ta_public __ta_nodiscard __ta_returns_nonnull
 void *ta_realloc(void *restrict tactx, void *restrict ptr, size_t size);
@@ -222,6 +228,23 @@ void *ta_memdup_array(void *restrict tactx, const void *restrict ptr, size_t siz
 __ta_public __ta_nodiscard __ta_returns_nonnull
 void *ta_assign_array(void *restrict tactx, void *restrict ptr, size_t size, size_t count);
 
+// Create a new TA chunk aligned to `alignment`, a power of two not less than
+// `sizeof(void *)`. The chunk keeps its alignment when it is reallocated or moved.
+__ta_public __ta_nodiscard __ta_returns_nonnull __ta_alloc_align(2)
+void *ta_alloc_aligned(void *tactx, size_t alignment, size_t size);
+
+// Create a new 0-initizialized aligned TA chunk.
+__ta_public __ta_nodiscard __ta_returns_nonnull __ta_alloc_align(2)
+void *ta_zalloc_aligned(void *tactx, size_t alignment, size_t size);
+
+// Change the size and the alignment of a TA chunk.
+__ta_public __ta_nodiscard __ta_returns_nonnull __ta_alloc_align(3)
+void *ta_realloc_aligned(void *restrict tactx, void *restrict ptr, size_t alignment, size_t size);
+
+// Create a new aligned TA array.
+__ta_public __ta_nodiscard __ta_returns_nonnull __ta_alloc_align(2)
+void *ta_alloc_array_aligned(void *restrict tactx, size_t alignment, size_t size, size_t count);
+
 // Create a new TA chunk from a string. The function is similar to `strdup()`.
 __ta_public __ta_nodiscard __ta_returns_nonnull
 char *ta_strdup(void *restrict tactx, const char *restrict str);
@@ -278,11 +301,40 @@ void ta_free(void *ptr);
 __ta_public
 void ta_free_children(void *ptr);
 
+// Free `n` TA chunks, last to first. NULL pointers are skipped. Runs of siblings
+// allocated one after another, listed in the order they were created in, are
+// unlinked from their parent with one splice, like the chunks of ta_alloc_many().
+__ta_public
+void ta_free_many(void **ptrs, size_t n);
+
+// A point in the life of a TA chunk to roll its children back to. Marks are
+// numbered in the order they are taken, and on an arena they keep its bump pointer.
+struct ta_mark {
+    size_t seq;
+    size_t carved; // chunks carved from the arena, with the ones released before
+    void *block; // block of the arena the bump pointer was in, or NULL
+    void *cur;
+};
+
+// Get a mark of the children a TA chunk has now.
+__ta_public __ta_nodiscard
+struct ta_mark ta_mark(void *tactx);
+
+// Free the direct children allocated or moved under a TA chunk after the mark,
+// newest first, with their subtrees and destructors. Chunks allocated after the
+// mark under older children stay. It takes no longer than freeing them one by one,
+// and on an arena each chunk just moves the bump pointer back, which goes back to
+// the mark once nothing carved after it is left. Older children may be freed or
+// reallocated in the meantime, the newest one at the mark included.
+__ta_public
+void ta_release_to(void *tactx, struct ta_mark mark);
+
 // Move children from one TA chunk to another.
 __ta_public
 void ta_move_children(void *restrict src, void *restrict dst);
 
-// Set the destructor function to be called when a TA chunk is freed.
+// Set the destructor function to be called when a TA chunk is freed, a build
+// without destructor support only accepts NULL.
 __ta_public
 ta_destructor ta_set_destructor(void *restrict ptr, ta_destructor destructor);
 
@@ -290,6 +342,134 @@ ta_destructor ta_set_destructor(void *restrict ptr, ta_destructor destructor);
 __ta_public __ta_nodiscard
 ta_destructor ta_get_destructor(void *ptr);
 
+// Backing allocator of TA chunks, every function gets `ctx` as its first argument.
+// Blocks have to be aligned like `malloc()` ones and are passed back with the size
+// they were requested with. `zalloc` and `resize` may be NULL, they are then done
+// with `alloc` and `release`.
+struct ta_allocator {
+    void *(*alloc)(void *ctx, size_t size);
+    void *(*zalloc)(void *ctx, size_t size);
+    void *(*resize)(void *ctx, void *ptr, size_t old_size, size_t size);
+    void (*release)(void *ctx, void *ptr, size_t size);
+    void *ctx;
+};
+
+// Move a TA chunk to the allocator, or back to libc with NULL, and return its new
+// address. Chunks allocated under it from then on come from the same allocator,
+// the allocator has to outlive all of them.
+__ta_public __ta_nodiscard __ta_returns_nonnull
+void *ta_set_allocator(void *ptr, const struct ta_allocator *allocator);
+
+// Get the allocator of a TA chunk, or NULL if it comes from libc.
+__ta_public __ta_nodiscard
+const struct ta_allocator *ta_get_allocator(void *ptr);
+
+// Allocate an empty TA chunk that is an arena. Chunks allocated under it are carved
+// from blocks of `size` bytes, or 64 KiB with 0, with a bump pointer. Freeing one of
+// them runs its destructor but returns no memory, the blocks are released together
+// with the arena. Chunks moved under a parent off the arena keep their address,
+// the blocks are then released once the last of them is freed too.
+__ta_public __ta_nodiscard __ta_returns_nonnull
+void *ta_arena_new(void *tactx, size_t size);
+
+// Allocate an empty TA chunk that is a pool of `size` bytes, like talloc_pool().
+// Chunks allocated under it are carved from the pool while it has room and come
+// from libc after that. They may be moved out of the pool and outlive it, the
+// pool memory is released once the pool and every chunk carved from it are gone.
+__ta_public __ta_nodiscard __ta_returns_nonnull
+void *ta_pool(void *tactx, size_t size);
+
+// Allocate an empty TA chunk with no parent whose children are carved from the
+// `len` bytes at `buf`, such as a buffer on the stack, like from an arena. Once it
+// is full they come from heap blocks. Chunks moved out of the context keep their
+// address, ta_set_allocator() with NULL copies one to the heap. Free the context,
+// and the chunks moved out that were not copied, before the buffer goes away.
+__ta_public __ta_nodiscard __ta_returns_nonnull
+void *ta_context_from_buffer(void *buf, size_t len);
+
+#ifndef _WIN32
+// Flags of ta_arena_map().
+enum {
+    TA_ARENA_HUGE     = 1 << 0, // advise blocks of 2 MiB and more to use huge pages
+    TA_ARENA_PREFAULT = 1 << 1, // fault in every page of a block when it is mapped
+};
+
+// Allocate an arena like ta_arena_new() whose blocks are mapped with `mmap()`.
+// The first block is mapped right away, so with TA_ARENA_PREFAULT chunks carved
+// from its `size` bytes never take a page fault. Chunks of any size are carved
+// while the block has room, only those that do not fit get a new mapping.
+__ta_public __ta_nodiscard __ta_returns_nonnull
+void *ta_arena_map(void *tactx, size_t size, unsigned flags);
+#endif
+
+// Memory held by an arena. On Linux, `huge_bytes` and `regular_bytes` split the
+// resident part of mapped blocks by page size, as the kernel reports it.
+struct ta_arena_stats {
+    size_t blocks;
+    size_t bytes;
+    size_t huge_bytes;
+    size_t regular_bytes;
+};
+
+// Get the memory held by an arena, or return false if the chunk is not one.
+__ta_public
+bool ta_get_arena_stats(void *arena, struct ta_arena_stats *stats);
+
+// Counters of the chunk cache of the calling thread, see `-Dcache=true`.
+// `blocks` and `bytes` are what the cache holds right now.
+struct ta_cache_stats {
+    size_t hits;
+    size_t misses;
+    size_t frees;
+    size_t evictions;
+    size_t flushes;
+    size_t blocks;
+    size_t bytes;
+};
+
+// Get the cache counters of the calling thread, or return false if the library
+// is built without the cache.
+__ta_public
+bool ta_get_cache_stats(struct ta_cache_stats *stats);
+
+// Return the blocks cached by the calling thread to libc. Threads do this on exit.
+__ta_public
+void ta_flush_cache(void);
+
+// Free all children of a TA chunk like ta_free_children(). An arena keeps its
+// first block and up to `retain` bytes of its other blocks for the chunks that
+// follow, SIZE_MAX keeps them all. Other chunks return their children to libc,
+// or to the cache and slabs of the thread with `-Dcache=true` and `-Dslab=true`.
+__ta_public
+void ta_reset(void *tactx, size_t retain);
+
+// Return memory the arenas in the subtree of a TA chunk hold without using it:
+// the blocks kept by ta_reset(), the blocks beyond the first of arenas whose chunk
+// has no children left, and the untouched pages of their current blocks. Returns the bytes released.
+// Arenas mapped with TA_ARENA_PREFAULT below the chunk are skipped, so they do not
+// fault again, calling this on such an arena itself trims it.
+__ta_public
+size_t ta_trim(void *tactx);
+
+// Return the chunk cache of the calling thread, the slab pages with no chunk left
+// in them and the free memory of libc to the system. Free slab blocks that other
+// threads hold keep their pages. Returns the bytes released by the library itself.
+__ta_public
+size_t ta_trim_all(void);
+
+// Set the name of a TA chunk to a copy of the string, or clear it with NULL.
+// A build without name support only accepts NULL.
+__ta_public
+const char *ta_set_name(void *restrict ptr, const char *restrict name);
+
+// Get the name of a TA chunk, or NULL if it has none.
+__ta_public __ta_nodiscard
+const char *ta_get_name(void *ptr);
+
+// Find a child of a TA chunk by name, any of them if several share the name.
+__ta_public __ta_nodiscard
+void *ta_find_child(void *restrict tactx, const char *restrict name);
+
 // Set the parent to a TA chunk.
 __ta_public __ta_returns_nonnull
 void *ta_set_parent(void *restrict ptr, void *restrict tactx);
@@ -310,6 +490,16 @@ bool ta_has_child(void *tactx, void *ptr);
 __ta_public __ta_nodiscard
 void *ta_get_child(void *ptr);
 
+// Get the number of children of a TA chunk.
+__ta_public __ta_nodiscard
+size_t ta_get_child_count(void *ptr);
+
+// Get the child of a TA chunk at the index, counting from ta_get_child() as 0,
+// or NULL if there are not that many children. It walks the list of children,
+// with -Dchild_array=true it takes O(log n) on wide parents, also between frees.
+__ta_public __ta_nodiscard
+void *ta_get_child_at(void *ptr, size_t index);
+
 // Get the next TA chunk which has the same parent.
 __ta_public __ta_nodiscard
 void *ta_get_next(void *ptr);
@@ -322,6 +512,171 @@ void *ta_get_prev(void *ptr);
 __ta_public __ta_nodiscard
 size_t ta_get_size(void *ptr);
 
+// Return values of ta_walk() callbacks. TA_WALK_SKIP skips the children and the
+// post-order visit of the chunk. A callback may free the chunk it is handed, which
+// skips them whatever it returns, but no other chunk of the walk.
+enum {
+    TA_WALK_CONTINUE,
+    TA_WALK_SKIP,
+    TA_WALK_STOP,
+};
+
+// Callback of ta_walk(), `depth` counts from 0 at the root of the walk.
+typedef int (*ta_walk_callback)(void *ptr, size_t depth, void *user);
+
+// Walk a TA chunk and all of its descendants depth first without recursion,
+// calling `pre` before the children of each chunk and `post` after them, either
+// may be NULL. Returns false if a callback stopped the walk.
+__ta_public
+bool ta_walk(void *tactx, ta_walk_callback pre, ta_walk_callback post, void *user);
+
+// State of an iteration over a TA chunk and all of its descendants, the same
+// order as ta_walk(). Only `ptr`, `depth` and `leaving` are meant to be read.
+struct ta_walker {
+    void *ptr;      // current chunk
+    size_t depth;   // depth of the current chunk below the root
+    bool leaving;   // the current chunk is visited after its children
+    bool post;
+    bool skip;
+    void *root;
+    void *header;
+    void *parent;
+    void *next;
+};
+
+// Start an iteration at a TA chunk, visiting chunks again after their children if `post`.
+__ta_public
+void ta_walker_init(struct ta_walker *restrict w, void *restrict tactx, bool post);
+
+// Advance to the next chunk of the iteration, or NULL once it is over.
+__ta_public
+void *ta_walker_next(struct ta_walker *w);
+
+// Skip the children and the post-order visit of the current chunk, this is
+// required before freeing it.
+__ta_public
+void ta_walker_skip(struct ta_walker *w);
+
+// Header layout of the library build for the inline accessors below. The header
+// size is zero if they have to call the exported functions, `prev` is zero if
+// siblings are linked forward only, `count` is zero if the size field holds it.
+struct ta_layout {
+    size_t header;
+    size_t parent;
+    size_t list;
+    size_t prev;
+    size_t next;
+    size_t size;
+    size_t size_mask;
+    size_t count;
+};
+
+__ta_public
+extern const struct ta_layout ta_layout;
+
+// Copies a header field without `<string.h>`, compilers turn either into a load.
+static inline
+void ta_layout_copy(void *dst, const void *src, size_t n)
+{
+#if __ta_has_builtin(__builtin_memcpy) || \
+    (defined(__GNUC__) && !defined(__TINYC__) && !defined(__PCC__))
+    __builtin_memcpy(dst, src, n);
+#else
+    for (size_t i = 0; i < n; ++i)
+        ((char *)dst)[i] = ((const char *)src)[i];
+#endif
+}
+
+static inline __ta_nodiscard
+void *ta_layout_load(const void *h, size_t offset)
+{
+    void *ptr;
+    ta_layout_copy(&ptr, (const char *)h + offset, sizeof(ptr));
+    return ptr;
+}
+
+// The chunk whose header is linked from the header of `ptr` at `offset`.
+static inline __ta_nodiscard
+void *ta_layout_chunk(void *ptr, size_t offset)
+{
+    size_t header = ta_layout.header;
+    char *h = (char *)ta_layout_load((char *)ptr - header, offset);
+    return h ? h + header : NULL;
+}
+
+// Inline versions of the read-only accessors, which skip the pointer checks.
+// Defining TA_INLINE before including this header makes them replace the
+// exported functions, also in the traversal macros.
+static inline __ta_nodiscard
+void *ta_inline_get_parent(void *ptr)
+{
+    if (__ta_unlikely(!ta_layout.header))
+        return ta_get_parent(ptr);
+    return ta_layout_chunk(ptr, ta_layout.parent);
+}
+
+static inline __ta_nodiscard
+void *ta_inline_get_child(void *ptr)
+{
+    if (__ta_unlikely(!ta_layout.header))
+        return ta_get_child(ptr);
+    return ta_layout_chunk(ptr, ta_layout.list);
+}
+
+static inline __ta_nodiscard
+void *ta_inline_get_next(void *ptr)
+{
+    if (__ta_unlikely(!ta_layout.header))
+        return ta_get_next(ptr);
+    return ta_layout_chunk(ptr, ta_layout.next);
+}
+
+static inline __ta_nodiscard
+void *ta_inline_get_prev(void *ptr)
+{
+    if (__ta_unlikely(!ta_layout.header || !ta_layout.prev))
+        return ta_get_prev(ptr);
+
+    // The first child links to the last one.
+    char *h = (char *)ptr - ta_layout.header;
+    char *h_parent = (char *)ta_layout_load(h, ta_layout.parent);
+    if (!h_parent || ta_layout_load(h_parent, ta_layout.list) == h)
+        return NULL;
+
+    return ta_layout_chunk(ptr, ta_layout.prev);
+}
+
+static inline __ta_nodiscard
+size_t ta_inline_get_size(void *ptr)
+{
+    if (__ta_unlikely(!ta_layout.header))
+        return ta_get_size(ptr);
+
+    size_t size;
+    ta_layout_copy(&size, (char *)ptr - ta_layout.header + ta_layout.size, sizeof(size));
+    return size & ta_layout.size_mask;
+}
+
+static inline __ta_nodiscard
+size_t ta_inline_get_child_count(void *ptr)
+{
+    if (__ta_unlikely(!ta_layout.header || !ta_layout.count))
+        return ta_get_child_count(ptr);
+
+    size_t count;
+    ta_layout_copy(&count, (char *)ptr - ta_layout.header + ta_layout.count, sizeof(count));
+    return count;
+}
+
+#if defined(TA_INLINE) && TA_INLINE
+#   define ta_get_parent(ptr) ta_inline_get_parent(ptr)
+#   define ta_get_child(ptr) ta_inline_get_child(ptr)
+#   define ta_get_next(ptr) ta_inline_get_next(ptr)
+#   define ta_get_prev(ptr) ta_inline_get_prev(ptr)
+#   define ta_get_size(ptr) ta_inline_get_size(ptr)
+#   define ta_get_child_count(ptr) ta_inline_get_child_count(ptr)
+#endif
+
 // Forward traversal of all children of a TA chunk.
 #define TA_FOREACH(ptr, tactx) \
     for ((ptr) = ta_get_child(tactx); \
@@ -0,0 +1,914 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __GLIBC__
+#   include <malloc.h>
+#endif
+
+#include "ta.h"
+
+#define BENCH(func) static void func(const char *__name, size_t n)
+
+// Keeps the results of benchmarked calls alive.
+static void *volatile bench_sink;
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// Bytes currently allocated from the system allocator, or 0 if unknown.
+static size_t bench_heap(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+static void bench_report(const char *name, size_t n, double ns, size_t bytes)
+{
+    printf("%-32s %9zu ops %10.2f ns/op", name, n, ns / (double)n);
+    if (bytes)
+        printf(" %8.2f B/chunk", (double)bytes / (double)n);
+    printf("\n");
+    fflush(stdout);
+}
+
+static void bench_alloc(const char *name, size_t n, size_t size)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    char buf[64];
+
+    size_t heap = bench_heap();
+    double t = bench_now();
+    for (size_t i = 0; i < n; ++i)
+        bench_sink = ta_alloc(tactx, size);
+    t = bench_now() - t;
+    heap = bench_heap() - heap;
+
+    snprintf(buf, sizeof(buf), "%s/alloc", name);
+    bench_report(buf, n, t, heap);
+
+    t = bench_now();
+    ta_free(tactx);
+    t = bench_now() - t;
+
+    snprintf(buf, sizeof(buf), "%s/free", name);
+    bench_report(buf, n, t, 0);
+}
+
+// Result sets of 1000 chunks are allocated and freed one by one, or in bulk.
+static void bench_many(const char *name, size_t n, bool bulk_alloc, bool bulk_free)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    void **arr = (void **)malloc(1000 * sizeof(void *));
+    double t_alloc = 0, t_free = 0;
+    char buf[64];
+
+    for (size_t i = 0; i < n; i += 1000) {
+        double t = bench_now();
+        if (bulk_alloc) {
+            ta_alloc_many(tactx, 48, 1000, arr);
+        } else {
+            for (size_t j = 0; j < 1000; ++j)
+                arr[j] = ta_alloc(tactx, 48);
+        }
+        t_alloc += bench_now() - t;
+
+        t = bench_now();
+        if (bulk_free) {
+            ta_free_many(arr, 1000);
+        } else {
+            for (size_t j = 0; j < 1000; ++j)
+                ta_free(arr[j]);
+        }
+        t_free += bench_now() - t;
+    }
+
+    snprintf(buf, sizeof(buf), "%s/alloc", name);
+    bench_report(buf, n, t_alloc, 0);
+    snprintf(buf, sizeof(buf), "%s/free", name);
+    bench_report(buf, n, t_free, 0);
+
+    free(arr);
+    ta_free(tactx);
+}
+
+BENCH(bench_many_loop)
+{
+    bench_many(__name, n, false, false);
+}
+
+BENCH(bench_many_bulk)
+{
+    bench_many(__name, n, true, true);
+}
+
+// Chunks allocated one by one and freed in bulk.
+BENCH(bench_many_free)
+{
+    bench_many(__name, n, false, true);
+}
+
+BENCH(bench_alloc_0)
+{
+    bench_alloc(__name, n, 0);
+}
+
+BENCH(bench_alloc_8)
+{
+    bench_alloc(__name, n, 8);
+}
+
+BENCH(bench_alloc_24)
+{
+    bench_alloc(__name, n, 24);
+}
+
+BENCH(bench_alloc_64)
+{
+    bench_alloc(__name, n, 64);
+}
+
+BENCH(bench_strdup)
+{
+    void *tactx = ta_alloc(NULL, 0);
+
+    size_t heap = bench_heap();
+    double t = bench_now();
+    for (size_t i = 0; i < n; ++i)
+        bench_sink = ta_strdup(tactx, "hello");
+    t = bench_now() - t;
+    heap = bench_heap() - heap;
+
+    bench_report(__name, n, t, heap);
+    ta_free(tactx);
+}
+
+static void bench_get_parent(const char *name, size_t n, bool inline_accessors)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    void **arr = (void **)ta_alloc_array(tactx, sizeof(void *), n);
+    for (size_t i = 0; i < n; ++i)
+        arr[i] = ta_alloc(tactx, 0);
+
+    double t = bench_now();
+    if (inline_accessors) {
+        for (size_t i = 0; i < n; ++i)
+            bench_sink = ta_inline_get_parent(arr[i]);
+    } else {
+        for (size_t i = 0; i < n; ++i)
+            bench_sink = ta_get_parent(arr[i]);
+    }
+    t = bench_now() - t;
+
+    bench_report(name, n, t, 0);
+    ta_free(tactx);
+}
+
+BENCH(bench_get_parent_wide)
+{
+    bench_get_parent(__name, n, false);
+}
+
+BENCH(bench_get_parent_wide_inline)
+{
+    bench_get_parent(__name, n, true);
+}
+
+static size_t bench_rand(uint64_t *seed, size_t n)
+{
+    *seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (size_t)(*seed >> 33) % n;
+}
+
+// Asks whether one of `count` chunks is an ancestor of another, `n` times.
+static void bench_has_child(const char *name, size_t n, void **arr, size_t count)
+{
+    uint64_t seed = 42;
+    size_t found = 0;
+
+    double t = bench_now();
+    for (size_t i = 0; i < n; ++i)
+        found += ta_has_child(arr[bench_rand(&seed, count)], arr[bench_rand(&seed, count)]);
+    t = bench_now() - t;
+
+    bench_sink = (void *)found;
+    bench_report(name, n, t, 0);
+}
+
+BENCH(bench_has_child_deep)
+{
+    void **arr = (void **)ta_alloc_array(NULL, sizeof(void *), 1024);
+    arr[0] = ta_alloc(NULL, 0);
+    for (size_t i = 1; i < 1024; ++i)
+        arr[i] = ta_alloc(arr[i - 1], 0);
+
+    bench_has_child(__name, n, arr, 1024);
+    ta_free(arr[0]);
+    ta_free(arr);
+}
+
+// Every chunk gets eight children, so the tree is about log8(n) deep.
+BENCH(bench_has_child_wide)
+{
+    void **arr = (void **)ta_alloc_array(NULL, sizeof(void *), n);
+    arr[0] = ta_alloc(NULL, 0);
+    for (size_t i = 1; i < n; ++i)
+        arr[i] = ta_alloc(arr[(i - 1) / 8], 0);
+
+    bench_has_child(__name, n, arr, n);
+    ta_free(arr[0]);
+    ta_free(arr);
+}
+
+// Picks random children of a parent with 1024 of them, as eviction would.
+BENCH(bench_child_at)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    for (size_t i = 0; i < 1024; ++i)
+        bench_sink = ta_alloc(tactx, 0);
+
+    uint64_t seed = 42;
+    double t = bench_now();
+    for (size_t i = 0; i < n; ++i)
+        bench_sink = ta_get_child_at(tactx, bench_rand(&seed, ta_get_child_count(tactx)));
+    t = bench_now() - t;
+
+    bench_report(__name, n, t, 0);
+    ta_free(tactx);
+}
+
+// Evicts random children of a parent with 65536 of them and puts new ones in.
+BENCH(bench_child_evict)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    for (size_t i = 0; i < 65536; ++i)
+        bench_sink = ta_alloc(tactx, 0);
+
+    uint64_t seed = 42;
+    double t = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        ta_free(ta_get_child_at(tactx, bench_rand(&seed, 65536)));
+        bench_sink = ta_alloc(tactx, 0);
+    }
+    t = bench_now() - t;
+
+    bench_report(__name, n, t, 0);
+    ta_free(tactx);
+}
+
+#if defined(TA_NAMES) && TA_NAMES
+// Looks up random names among 1024 named children, by the index or by a walk.
+static void bench_find(const char *name, size_t n, bool walk)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    char buf[32];
+    for (size_t i = 0; i < 1024; ++i) {
+        snprintf(buf, sizeof(buf), "child-%zu", i);
+        ta_set_name(ta_alloc(tactx, 0), buf);
+    }
+
+    uint64_t seed = 42;
+    double t = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(buf, sizeof(buf), "child-%zu", bench_rand(&seed, 1024));
+        if (walk) {
+            void *ptr;
+            TA_FOREACH(ptr, tactx) {
+                if (!strcmp(ta_get_name(ptr), buf))
+                    break;
+            }
+            bench_sink = ptr;
+        } else {
+            bench_sink = ta_find_child(tactx, buf);
+        }
+    }
+    t = bench_now() - t;
+
+    bench_report(name, n, t, 0);
+    ta_free(tactx);
+}
+
+BENCH(bench_find_child)
+{
+    bench_find(__name, n, false);
+}
+
+BENCH(bench_find_child_walk)
+{
+    bench_find(__name, n, true);
+}
+#endif
+
+// Moves a chain of 64 chunks back and forth between two parents.
+BENCH(bench_set_parent_deep)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    void *a = ta_alloc(tactx, 0);
+    void *b = ta_alloc(tactx, 0);
+    void *chain = ta_alloc(a, 0);
+    void *ptr = chain;
+    for (size_t i = 1; i < 64; ++i)
+        ptr = ta_alloc(ptr, 0);
+
+    double t = bench_now();
+    for (size_t i = 0; i < n; ++i)
+        ta_set_parent(chain, i % 2 ? a : b);
+    t = bench_now() - t;
+
+    bench_report(__name, n, t, 0);
+    ta_free(tactx);
+}
+
+static void bench_walk(const char *name, size_t n, size_t size, bool inline_accessors)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    for (size_t i = 0; i < n; ++i)
+        bench_sink = ta_alloc(tactx, size);
+
+    void *ptr;
+    double t = bench_now();
+    if (inline_accessors) {
+        for (ptr = ta_inline_get_child(tactx); ptr; ptr = ta_inline_get_next(ptr))
+            bench_sink = ptr;
+    } else {
+        TA_FOREACH(ptr, tactx) {
+            bench_sink = ptr;
+        }
+    }
+    t = bench_now() - t;
+
+    bench_report(name, n, t, 0);
+    ta_free(tactx);
+}
+
+BENCH(bench_walk_wide)
+{
+    bench_walk(__name, n, 256, false);
+}
+
+BENCH(bench_walk_wide_small)
+{
+    bench_walk(__name, n, 16, false);
+}
+
+BENCH(bench_walk_wide_small_inline)
+{
+    bench_walk(__name, n, 16, true);
+}
+
+// Walks 64 children over and over, so the walk stays in cache.
+static void bench_hot(const char *name, size_t n, bool inline_accessors)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    for (size_t i = 0; i < 64; ++i)
+        bench_sink = ta_alloc(tactx, 16);
+
+    void *ptr;
+    double t = bench_now();
+    for (size_t i = 0; i < n / 64; ++i) {
+        if (inline_accessors) {
+            for (ptr = ta_inline_get_child(tactx); ptr; ptr = ta_inline_get_next(ptr))
+                bench_sink = ptr;
+        } else {
+            TA_FOREACH(ptr, tactx) {
+                bench_sink = ptr;
+            }
+        }
+    }
+    t = bench_now() - t;
+
+    bench_report(name, n / 64 * 64, t, 0);
+    ta_free(tactx);
+}
+
+BENCH(bench_walk_hot)
+{
+    bench_hot(__name, n, false);
+}
+
+BENCH(bench_walk_hot_inline)
+{
+    bench_hot(__name, n, true);
+}
+
+static size_t bench_walk_recursive(void *ptr)
+{
+    size_t count = 1;
+    void *child;
+    TA_FOREACH(child, ptr) {
+        count += bench_walk_recursive(child);
+    }
+    return count;
+}
+
+static int bench_walk_count(void *ptr, size_t depth, void *user)
+{
+    (void)ptr;
+    (void)depth;
+    ++*(size_t *)user;
+    return TA_WALK_CONTINUE;
+}
+
+// Visits a tree where every chunk gets eight children, like bench_has_child_wide,
+// by recursion in user code, by ta_walk() or by the walker.
+static void bench_tree(const char *name, size_t n, int how)
+{
+    void **arr = (void **)ta_alloc_array(NULL, sizeof(void *), n);
+    arr[0] = ta_alloc(NULL, 0);
+    for (size_t i = 1; i < n; ++i)
+        arr[i] = ta_alloc(arr[(i - 1) / 8], 16);
+
+    size_t count = 0;
+    double t = bench_now();
+    if (how == 0) {
+        count = bench_walk_recursive(arr[0]);
+    } else if (how == 1) {
+        ta_walk(arr[0], bench_walk_count, NULL, &count);
+    } else {
+        struct ta_walker w;
+        ta_walker_init(&w, arr[0], false);
+        while (ta_walker_next(&w))
+            count++;
+    }
+    t = bench_now() - t;
+
+    bench_sink = (void *)count;
+    bench_report(name, count, t, 0);
+    ta_free(arr[0]);
+    ta_free(arr);
+}
+
+BENCH(bench_walk_tree_recursive)
+{
+    bench_tree(__name, n, 0);
+}
+
+BENCH(bench_walk_tree)
+{
+    bench_tree(__name, n, 1);
+}
+
+BENCH(bench_walk_tree_walker)
+{
+    bench_tree(__name, n, 2);
+}
+
+// These are quadratic when siblings are linked forward only.
+#if !defined(TA_BACKLINKS) || TA_BACKLINKS
+BENCH(bench_move_children_wide)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    void *src = ta_alloc(tactx, 0);
+    void *dst = ta_alloc(tactx, 0);
+    for (size_t i = 0; i < n; ++i)
+        bench_sink = ta_alloc(dst, 0);
+
+    double t = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        bench_sink = ta_alloc(src, 0);
+        ta_move_children(src, dst);
+    }
+    t = bench_now() - t;
+
+    bench_report(__name, n, t, 0);
+    ta_free(tactx);
+}
+
+BENCH(bench_walk_wide_reverse)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    void *last = ta_alloc(tactx, 256);
+    for (size_t i = 1; i < n; ++i)
+        bench_sink = ta_alloc(tactx, 256);
+
+    double t = bench_now();
+    TA_FOREACH_REVERSE_FROM(last, tactx) {
+        bench_sink = last;
+    }
+    t = bench_now() - t;
+
+    bench_report(__name, n, t, 0);
+    ta_free(tactx);
+}
+
+BENCH(bench_free_wide_random)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    void **arr = (void **)ta_alloc_array(NULL, sizeof(void *), n);
+    for (size_t i = 0; i < n; ++i)
+        arr[i] = ta_alloc(tactx, 16);
+
+    uint64_t x = 42;
+    for (size_t i = n; i > 1; --i) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        size_t j = (size_t)(x >> 33) % i;
+        void *tmp = arr[i - 1];
+        arr[i - 1] = arr[j];
+        arr[j] = tmp;
+    }
+
+    double t = bench_now();
+    for (size_t i = 0; i < n; ++i)
+        ta_free(arr[i]);
+    t = bench_now() - t;
+
+    bench_report(__name, n, t, 0);
+    ta_free(arr);
+    ta_free(tactx);
+}
+#endif
+
+BENCH(bench_free_deep)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    void *ptr = tactx;
+    for (size_t i = 0; i < n; ++i)
+        ptr = ta_alloc(ptr, 0);
+
+    double t = bench_now();
+    ta_free(tactx);
+    t = bench_now() - t;
+
+    bench_report(__name, n, t, 0);
+}
+
+// Chunks are allocated and freed in batches of 64, which keeps them hot in
+// whatever free lists the allocator has. `libc` times plain malloc() for reference.
+static void bench_churn(const char *name, size_t n, size_t size, bool libc)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    void *arr[64];
+
+    double t = bench_now();
+    for (size_t i = 0; i < n; i += 64) {
+        for (size_t j = 0; j < 64; ++j)
+            arr[j] = libc ? malloc(size) : ta_alloc(tactx, size);
+        bench_sink = arr[63];
+        for (size_t j = 0; j < 64; ++j) {
+            if (libc) {
+                free(arr[j]);
+            } else {
+                ta_free(arr[j]);
+            }
+        }
+    }
+    t = bench_now() - t;
+
+    bench_report(name, n, t, 0);
+    ta_free(tactx);
+}
+
+BENCH(bench_churn_24)
+{
+    bench_churn(__name, n, 24, false);
+}
+
+BENCH(bench_churn_24_malloc)
+{
+    bench_churn(__name, n, 24, true);
+}
+
+BENCH(bench_churn_512)
+{
+    bench_churn(__name, n, 512, false);
+}
+
+BENCH(bench_churn_512_malloc)
+{
+    bench_churn(__name, n, 512, true);
+}
+
+// A context of 64 small chunks is allocated and freed as a whole, over and over.
+static void bench_context(const char *name, size_t n, bool arena)
+{
+    double t = bench_now();
+    for (size_t i = 0; i < n; i += 64) {
+        void *tactx = arena ? ta_arena_new(NULL, 0) : ta_alloc(NULL, 0);
+        for (size_t j = 0; j < 64; j += 2) {
+            void *ptr = ta_alloc(tactx, 24);
+            bench_sink = ta_strdup(ptr, "hello");
+        }
+        ta_free(tactx);
+    }
+    t = bench_now() - t;
+
+    bench_report(name, n, t, 0);
+}
+
+BENCH(bench_request)
+{
+    bench_context(__name, n, false);
+}
+
+BENCH(bench_request_arena)
+{
+    bench_context(__name, n, true);
+}
+
+// An event loop allocates 64 small chunks per iteration in a long-lived context
+// and drops them all at its end.
+static void bench_loop(const char *name, size_t n, bool reset)
+{
+    void *tactx = reset ? ta_arena_new(NULL, 0) : ta_alloc(NULL, 0);
+
+    double t = bench_now();
+    for (size_t i = 0; i < n; i += 64) {
+        for (size_t j = 0; j < 64; j += 2) {
+            void *ptr = ta_alloc(tactx, 24);
+            bench_sink = ta_strdup(ptr, "hello");
+        }
+        if (reset) {
+            ta_reset(tactx, SIZE_MAX);
+        } else {
+            ta_free_children(tactx);
+        }
+    }
+    t = bench_now() - t;
+
+    bench_report(name, n, t, 0);
+    ta_free(tactx);
+}
+
+BENCH(bench_loop_free_children)
+{
+    bench_loop(__name, n, false);
+}
+
+BENCH(bench_loop_reset)
+{
+    bench_loop(__name, n, true);
+}
+
+// A buffer grows by 4 KiB at a time up to 64 MiB, with small chunks allocated in
+// between, see `-Dmmap_threshold`.
+BENCH(bench_grow_huge)
+{
+    size_t steps = n < 16384 ? n : 16384;
+    void *tactx = ta_alloc(NULL, 0);
+    char *buf = NULL;
+
+    double t = bench_now();
+    for (size_t i = 1; i <= steps; ++i) {
+        buf = (char *)ta_realloc(tactx, buf, i * 4096);
+        memset(buf + (i - 1) * 4096, 1, 4096);
+        bench_sink = ta_alloc(tactx, 64);
+    }
+    t = bench_now() - t;
+
+    bench_report(__name, steps, t, 0);
+    ta_free(tactx);
+}
+
+// A struct owning 12 small strings is built and freed, in a pool or not.
+static void bench_object(const char *name, size_t n, bool pool)
+{
+    double t = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        void *tactx = pool ? ta_pool(NULL, 1536) : NULL;
+        char **obj = (char **)ta_alloc_array(tactx, sizeof(char *), 12);
+        for (size_t j = 0; j < 12; ++j)
+            obj[j] = ta_strdup(obj, "field value");
+        bench_sink = obj;
+        ta_free(pool ? tactx : obj);
+    }
+    t = bench_now() - t;
+
+    bench_report(name, n, t, 0);
+}
+
+BENCH(bench_object_heap)
+{
+    bench_object(__name, n, false);
+}
+
+BENCH(bench_object_pool)
+{
+    bench_object(__name, n, true);
+}
+
+// A parser allocates 16 nodes for a branch that fails and rolls them back, the
+// context is a plain chunk or an arena.
+static void bench_rollback(const char *name, size_t n, bool arena)
+{
+    void *tactx = arena ? ta_arena_new(NULL, 0) : ta_alloc(NULL, 0);
+    bench_sink = ta_alloc(tactx, 64);
+
+    double t = bench_now();
+    for (size_t i = 0; i < n; i += 16) {
+        struct ta_mark mark = ta_mark(tactx);
+        for (size_t j = 0; j < 16; ++j)
+            bench_sink = ta_alloc(tactx, 48);
+        ta_release_to(tactx, mark);
+    }
+    t = bench_now() - t;
+
+    bench_report(name, n, t, 0);
+    ta_free(tactx);
+}
+
+BENCH(bench_rollback_heap)
+{
+    bench_rollback(__name, n, false);
+}
+
+BENCH(bench_rollback_arena)
+{
+    bench_rollback(__name, n, true);
+}
+
+// A path is built in a scratch context and discarded, the context is on the heap
+// or over a buffer on the stack.
+static void bench_scratch(const char *name, size_t n, bool buffer)
+{
+    char buf[1024];
+
+    double t = bench_now();
+    for (size_t i = 0; i < n; i += 8) {
+        void *tactx = buffer ? ta_context_from_buffer(buf, sizeof(buf)) : ta_alloc(NULL, 0);
+        char *path = ta_strdup(tactx, "/usr");
+        for (size_t j = 0; j < 8; ++j)
+            path = ta_strdup_append(path, "/dir");
+        bench_sink = path;
+        ta_free(tactx);
+    }
+    t = bench_now() - t;
+
+    bench_report(name, n, t, 0);
+}
+
+BENCH(bench_scratch_heap)
+{
+    bench_scratch(__name, n, false);
+}
+
+BENCH(bench_scratch_buffer)
+{
+    bench_scratch(__name, n, true);
+}
+
+// Chunks are carved from an arena that was sized to hold them all and written
+// to, so the first touch of every page is timed unless the arena prefaulted them.
+static void bench_first_touch(const char *name, size_t n, bool mapped)
+{
+    size_t size = n * 256;
+#ifndef _WIN32
+    void *arena = mapped ? ta_arena_map(NULL, size, TA_ARENA_HUGE | TA_ARENA_PREFAULT)
+                         : ta_arena_new(NULL, size);
+#else
+    (void)mapped;
+    void *arena = ta_arena_new(NULL, size);
+#endif
+
+    double t = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        void *ptr = ta_alloc(arena, 64);
+        memset(ptr, 0, 64);
+        bench_sink = ptr;
+    }
+    t = bench_now() - t;
+
+    bench_report(name, n, t, 0);
+    ta_free(arena);
+}
+
+BENCH(bench_touch_arena)
+{
+    bench_first_touch(__name, n, false);
+}
+
+BENCH(bench_touch_arena_mapped)
+{
+    bench_first_touch(__name, n, true);
+}
+
+static void bench_destructor(void *ptr)
+{
+    bench_sink = ptr;
+}
+
+// Every chunk gets eight children until `n` chunks are allocated, and every
+// chunk with an index divisible by `every` gets a destructor.
+static void bench_free_fan(const char *name, size_t n, size_t every)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    void **queue = (void **)ta_alloc_array(NULL, sizeof(void *), n);
+    size_t head = 0, tail = 0;
+
+    queue[tail++] = tactx;
+    while (tail < n) {
+        void *ptr = queue[head++];
+        for (size_t i = 0; i < 8 && tail < n; ++i) {
+            void *child = queue[tail++] = ta_alloc(ptr, 16);
+            if (every && tail % every == 0)
+                ta_set_destructor(child, bench_destructor);
+        }
+    }
+    ta_free(queue);
+
+    double t = bench_now();
+    ta_free(tactx);
+    t = bench_now() - t;
+
+    bench_report(name, n, t, 0);
+}
+
+BENCH(bench_free_fan_plain)
+{
+    bench_free_fan(__name, n, 0);
+}
+
+#if !defined(TA_DESTRUCTORS) || TA_DESTRUCTORS
+BENCH(bench_free_fan_sparse)
+{
+    bench_free_fan(__name, n, 4096);
+}
+
+BENCH(bench_free_fan_destructors)
+{
+    bench_free_fan(__name, n, 1);
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    struct {
+        const char *name;
+        void (*func)(const char *__name, size_t n);
+    } benches[] = {
+        { "alloc_0", bench_alloc_0 },
+        { "alloc_8", bench_alloc_8 },
+        { "alloc_24", bench_alloc_24 },
+        { "alloc_64", bench_alloc_64 },
+        { "strdup", bench_strdup },
+        { "many_loop", bench_many_loop },
+        { "many_bulk", bench_many_bulk },
+        { "many_free", bench_many_free },
+        { "churn_24", bench_churn_24 },
+        { "churn_24_malloc", bench_churn_24_malloc },
+        { "churn_512", bench_churn_512 },
+        { "churn_512_malloc", bench_churn_512_malloc },
+        { "request", bench_request },
+        { "request_arena", bench_request_arena },
+        { "loop_free_children", bench_loop_free_children },
+        { "loop_reset", bench_loop_reset },
+        { "grow_huge", bench_grow_huge },
+        { "object_heap", bench_object_heap },
+        { "object_pool", bench_object_pool },
+        { "rollback_heap", bench_rollback_heap },
+        { "rollback_arena", bench_rollback_arena },
+        { "scratch_heap", bench_scratch_heap },
+        { "scratch_buffer", bench_scratch_buffer },
+        { "touch_arena", bench_touch_arena },
+        { "touch_arena_mapped", bench_touch_arena_mapped },
+        { "get_parent_wide", bench_get_parent_wide },
+        { "get_parent_wide_inline", bench_get_parent_wide_inline },
+        { "has_child_deep", bench_has_child_deep },
+        { "has_child_wide", bench_has_child_wide },
+        { "set_parent_deep", bench_set_parent_deep },
+        { "child_at", bench_child_at },
+        { "child_evict", bench_child_evict },
+#if defined(TA_NAMES) && TA_NAMES
+        { "find_child", bench_find_child },
+        { "find_child_walk", bench_find_child_walk },
+#endif
+        { "walk_wide", bench_walk_wide },
+        { "walk_wide_small", bench_walk_wide_small },
+        { "walk_wide_small_inline", bench_walk_wide_small_inline },
+        { "walk_hot", bench_walk_hot },
+        { "walk_hot_inline", bench_walk_hot_inline },
+        { "walk_tree_recursive", bench_walk_tree_recursive },
+        { "walk_tree", bench_walk_tree },
+        { "walk_tree_walker", bench_walk_tree_walker },
+#if !defined(TA_BACKLINKS) || TA_BACKLINKS
+        { "move_children_wide", bench_move_children_wide },
+        { "walk_wide_reverse", bench_walk_wide_reverse },
+        { "free_wide_random", bench_free_wide_random },
+#endif
+        { "free_deep", bench_free_deep },
+        { "free_fan_plain", bench_free_fan_plain },
+#if !defined(TA_DESTRUCTORS) || TA_DESTRUCTORS
+        { "free_fan_sparse", bench_free_fan_sparse },
+        { "free_fan_destructors", bench_free_fan_destructors },
+#endif
+    };
+
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+
+    for (size_t i = 0, m = sizeof(benches) / sizeof(benches[0]); i < m; ++i) {
+        if (argc > 2 && !strstr(benches[i].name, argv[2]))
+            continue;
+        benches[i].func(benches[i].name, n);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -1,8 +1,13 @@
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 
+#if (defined(TA_SLAB) && TA_SLAB) || (defined(TA_CACHE) && TA_CACHE)
+#   include <pthread.h>
+#endif
+
 #include "ta.h"
 
 #define TEST(func) static void func(const char *__unit)
@@ -305,6 +310,150 @@ TEST(test_ta_get_child)
     ta_free(tactx);
 }
 
+#if !defined(TA_DESTRUCTORS) || TA_DESTRUCTORS
+static size_t count_seen;
+
+static void count_destructor(void *ptr)
+{
+    count_seen = ta_get_child_count(ta_get_parent(ptr));
+}
+#endif
+
+TEST(test_ta_get_child_count)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    void *other = ta_alloc(NULL, 0);
+    assert_equal(ta_get_child_count(tactx), 0);
+
+    void *arr[100];
+    for (size_t i = 0; i < 100; ++i) {
+        arr[i] = ta_alloc(tactx, 0);
+        assert_equal(ta_get_child_count(tactx), i + 1);
+    }
+
+    for (size_t i = 0; i < 2; ++i) {
+        void *ptr = ta_alloc(arr[0], 0);
+        assert_equal(ta_get_parent(ptr), arr[0]);
+    }
+    assert_equal(ta_get_child_count(arr[0]), 2);
+    assert_equal(ta_get_child_count(tactx), 100);
+
+    ta_free(arr[99]);
+    ta_free(arr[50]);
+    assert_equal(ta_get_child_count(tactx), 98);
+
+    ta_set_parent(arr[1], other);
+    ta_set_parent(arr[2], NULL);
+    assert_equal(ta_get_child_count(tactx), 96);
+    assert_equal(ta_get_child_count(other), 1);
+
+    // Reparenting to the same parent and moving in place keep the count.
+    ta_set_parent(arr[3], tactx);
+    arr[4] = ta_realloc(tactx, arr[4], 4096);
+    assert_equal(ta_get_child_count(tactx), 96);
+
+    ta_move_children(tactx, other);
+    assert_equal(ta_get_child_count(tactx), 0);
+    assert_equal(ta_get_child_count(other), 97);
+
+    ta_move_children(arr[0], arr[1]);
+    assert_equal(ta_get_child_count(arr[0]), 0);
+    assert_equal(ta_get_child_count(arr[1]), 2);
+
+#if !defined(TA_DESTRUCTORS) || TA_DESTRUCTORS
+    // Destructors see the count of siblings still alive.
+    ta_set_destructor(arr[5], count_destructor);
+    ta_free(arr[5]);
+    assert_equal(count_seen, 97);
+    assert_equal(ta_get_child_count(other), 96);
+
+    ta_set_destructor(arr[6], count_destructor);
+    ta_free_children(other);
+    assert_equal(ta_get_child_count(other), 0);
+#endif
+
+    ta_free_children(other);
+    assert_equal(ta_get_child_count(other), 0);
+
+    // Counts past 16 bits, which compact headers no longer keep.
+    enum { WIDE = 70000 };
+    void *first = ta_alloc(other, 0);
+    for (size_t i = 1; i < WIDE; ++i)
+        assert_equal(ta_get_size(ta_alloc(other, 0)), 0);
+    assert_equal(ta_get_child_count(other), WIDE);
+    assert_equal(ta_get_child_at(other, WIDE - 1), first);
+    assert_null(ta_get_child_at(other, WIDE));
+
+    for (size_t i = 10; i < WIDE; ++i)
+        ta_free(ta_get_child(other));
+    assert_equal(ta_get_child_count(other), 10);
+    assert_equal(ta_get_child_at(other, 9), first);
+    assert_equal(ta_get_size(ta_alloc(other, 0)), 0);
+    assert_equal(ta_get_child_count(other), 11);
+
+    ta_free_children(other);
+    assert_equal(ta_get_child_count(other), 0);
+
+    ta_free(arr[2]);
+    ta_free(other);
+    ta_free(tactx);
+}
+
+TEST(test_ta_get_child_at)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    void *arr[200];
+    size_t n = 0;
+
+    assert_null(ta_get_child_at(tactx, 0));
+
+    for (size_t i = 0; i < 200; ++i)
+        arr[n++] = ta_alloc(tactx, 0);
+
+    // Removals from wide parents leave the positions shifted.
+    for (size_t round = 0; round < 4; ++round) {
+        size_t i = 0;
+        void *ptr;
+        TA_FOREACH(ptr, tactx) {
+            assert_equal(ta_get_child_at(tactx, i), ptr);
+            i++;
+        }
+        assert_equal(i, n);
+        assert_equal(ta_get_child_count(tactx), n);
+        assert_null(ta_get_child_at(tactx, n));
+        assert_null(ta_get_child_at(tactx, SIZE_MAX));
+
+        for (i = 0; i < n; i += 3) {
+            ta_free(arr[i]);
+            arr[i] = NULL;
+        }
+        for (size_t j = i = 0; j < n; ++j) {
+            if (arr[j])
+                arr[i++] = arr[j];
+        }
+        n = i;
+    }
+
+    // Evicting random children and adding new ones keeps the positions right.
+    for (size_t step = 0; step < 1000; ++step) {
+        ta_free(ta_get_child_at(tactx, step * 7919 % n));
+        assert_equal(ta_get_size(ta_alloc(tactx, 0)), 0);
+        assert_equal(ta_get_child_count(tactx), n);
+
+        if (step % 100 == 0) {
+            size_t i = 0;
+            void *ptr;
+            TA_FOREACH(ptr, tactx) {
+                assert_equal(ta_get_child_at(tactx, i), ptr);
+                i++;
+            }
+            assert_equal(i, n);
+        }
+    }
+
+    ta_free(tactx);
+}
+
 TEST(test_ta_get_next)
 {
     void *tactx = ta_alloc(NULL, 0);
@@ -383,6 +532,39 @@ TEST(test_ta_get_prev)
     ta_free(tactx);
 }
 
+// Checks the inline accessors against the exported ones on `ptr` and below. The
+// parentheses keep the exported ones when TA_INLINE replaces them.
+static void check_inline(const char *__unit, void *ptr)
+{
+    assert_equal(ta_inline_get_parent(ptr), (ta_get_parent)(ptr));
+    assert_equal(ta_inline_get_child(ptr), (ta_get_child)(ptr));
+    assert_equal(ta_inline_get_next(ptr), (ta_get_next)(ptr));
+    assert_equal(ta_inline_get_prev(ptr), (ta_get_prev)(ptr));
+    assert_equal(ta_inline_get_size(ptr), (ta_get_size)(ptr));
+    assert_equal(ta_inline_get_child_count(ptr), (ta_get_child_count)(ptr));
+
+    void *child;
+    TA_FOREACH(child, ptr) {
+        check_inline(__unit, child);
+    }
+}
+
+TEST(test_ta_inline)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    check_inline(__unit, tactx);
+
+    for (size_t i = 0; i < 50; ++i) {
+        void *ptr = ta_alloc(tactx, i);
+        for (size_t j = 0; j < i % 4; ++j)
+            assert_equal(ta_get_parent(ta_alloc(ptr, j)), ptr);
+    }
+    ta_free(ta_get_child_at(tactx, 10));
+    check_inline(__unit, tactx);
+
+    ta_free(tactx);
+}
+
 TEST(test_ta_has_parent)
 {
     void *tactx = ta_alloc(NULL, 0);
@@ -467,6 +649,83 @@ TEST(test_ta_has_child)
     ta_free(tactx);
 }
 
+#define ANCESTRY_N 200
+
+static size_t ancestry_rand(size_t *seed, size_t n)
+{
+    *seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (*seed >> 33) % n;
+}
+
+static bool ancestry_model(const size_t *par, size_t i, size_t j)
+{
+    for (i = par[i]; i != SIZE_MAX; i = par[i]) {
+        if (i == j)
+            return true;
+    }
+    return false;
+}
+
+// Reparents, moves and reallocates chunks of a random tree and checks every
+// pair of chunks against a model of the tree.
+TEST(test_ta_ancestry)
+{
+    void *arr[ANCESTRY_N];
+    size_t par[ANCESTRY_N];
+    size_t seed = 1;
+
+    arr[0] = ta_alloc(NULL, 0);
+    par[0] = SIZE_MAX;
+    for (size_t i = 1; i < ANCESTRY_N; ++i) {
+        par[i] = ancestry_rand(&seed, i);
+        arr[i] = ta_alloc(arr[par[i]], 0);
+    }
+
+    for (size_t round = 0; round < 50; ++round) {
+        size_t i = ancestry_rand(&seed, ANCESTRY_N);
+        size_t j = ancestry_rand(&seed, ANCESTRY_N);
+
+        switch (round % 4) {
+        case 0:
+            if (i == j || ancestry_model(par, j, i))
+                break;
+            ta_set_parent(arr[i], arr[j]);
+            par[i] = j;
+            break;
+        case 1:
+            if (i == j || ancestry_model(par, j, i))
+                break;
+            ta_move_children(arr[i], arr[j]);
+            for (size_t k = 0; k < ANCESTRY_N; ++k) {
+                if (par[k] == i)
+                    par[k] = j;
+            }
+            break;
+        case 2:
+            arr[i] = ta_realloc(ta_get_parent(arr[i]), arr[i], 4096 * (round + 1));
+            break;
+        default:
+            if (i && par[i] != SIZE_MAX && round % 8 == 7) {
+                ta_set_parent(arr[i], NULL);
+                par[i] = SIZE_MAX;
+            }
+            break;
+        }
+
+        for (i = 0; i < ANCESTRY_N; ++i) {
+            for (j = 0; j < ANCESTRY_N; ++j) {
+                assert_equal(ta_has_parent(arr[i], arr[j]), ancestry_model(par, i, j));
+                assert_equal(ta_has_child(arr[j], arr[i]), ancestry_model(par, i, j));
+            }
+        }
+    }
+
+    for (size_t i = 0; i < ANCESTRY_N; ++i) {
+        if (par[i] == SIZE_MAX)
+            ta_free(arr[i]);
+    }
+}
+
 TEST(test_ta_move_children)
 {
     void *tactx = ta_alloc(NULL, 0);
@@ -564,6 +823,167 @@ TEST(test_ta_move_children)
     ta_free(tactx);
 }
 
+// Check that forward and backward links of the children of `tactx` agree.
+static size_t check_children(const char *__unit, void *tactx)
+{
+    size_t n = 0;
+    void *ptr, *prev = NULL;
+    TA_FOREACH(ptr, tactx) {
+        assert_equal(ta_get_parent(ptr), tactx);
+        assert_equal(ta_get_prev(ptr), prev);
+        assert_true(ta_has_child(tactx, ptr));
+        prev = ptr;
+        n++;
+    }
+
+    size_t m = 0;
+    TA_FOREACH_REVERSE_FROM(prev, tactx) {
+        m++;
+    }
+
+    assert_equal(n, m);
+    return n;
+}
+
+TEST(test_ta_links)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    assert_equal(check_children(__unit, tactx), 0);
+
+    void *arr[10];
+    for (size_t i = 0; i < 10; ++i) {
+        arr[i] = ta_alloc(tactx, i);
+        assert_equal(check_children(__unit, tactx), i + 1);
+    }
+
+    for (size_t i = 0; i < 10; ++i) {
+        void *ptr = ta_alloc(arr[9], i);
+        assert_equal(ta_get_parent(ptr), arr[9]);
+    }
+
+    // Move the parent of 10 children, the first, a middle and the last child.
+    arr[9] = ta_realloc(tactx, arr[9], 4096);
+    assert_equal(check_children(__unit, arr[9]), 10);
+    arr[0] = ta_realloc(tactx, arr[0], 4096);
+    arr[5] = ta_realloc(tactx, arr[5], 4096);
+    arr[9] = ta_realloc(tactx, arr[9], 8192);
+    assert_equal(check_children(__unit, tactx), 10);
+    assert_equal(check_children(__unit, arr[9]), 10);
+
+    // Move the only child.
+    void *ptr = ta_alloc(arr[1], 0);
+    ptr = ta_realloc(arr[1], ptr, 4096);
+    assert_equal(check_children(__unit, arr[1]), 1);
+    assert_equal(ta_get_child(arr[1]), ptr);
+
+    ta_move_children(arr[9], arr[1]);
+    assert_equal(check_children(__unit, arr[1]), 11);
+    assert_null(ta_get_child(arr[9]));
+
+    ta_set_parent(arr[4], arr[1]);
+    ta_free(arr[6]);
+    assert_equal(check_children(__unit, tactx), 8);
+    assert_equal(check_children(__unit, arr[1]), 12);
+
+    ta_free(tactx);
+}
+
+// Checks that the children of `tactx` are exactly `arr[0..n)` from the first one.
+static void check_order(const char *__unit, void *tactx, void **arr, size_t n)
+{
+    size_t i = 0;
+    void *ptr;
+    TA_FOREACH(ptr, tactx) {
+        assert_true(i < n);
+        assert_equal(ptr, arr[i++]);
+    }
+    assert_equal(i, n);
+    assert_equal(ta_get_child_count(tactx), n);
+
+    ptr = n ? arr[n - 1] : NULL;
+    TA_FOREACH_REVERSE_FROM(ptr, tactx) {
+        assert_equal(ptr, arr[--i]);
+    }
+    assert_equal(i, 0);
+}
+
+TEST(test_ta_wide)
+{
+    enum { N = 1000 };
+    void *tactx = ta_alloc(NULL, 0);
+    void *other = ta_alloc(NULL, 0);
+    void **arr = (void **)ta_alloc_array(NULL, sizeof(void *), N * 3);
+    size_t n = 0;
+
+    for (size_t i = 0; i < N; ++i) {
+        memmove(arr + 1, arr, n++ * sizeof(void *));
+        arr[0] = ta_zalloc(tactx, i % 64);
+    }
+    check_order(__unit, tactx, arr, n);
+
+    // Free every third child, then the first and last ones.
+    for (size_t i = n; i-- > 0;) {
+        if (i % 3 == 1) {
+            ta_free(arr[i]);
+            memmove(arr + i, arr + i + 1, (--n - i) * sizeof(void *));
+        }
+    }
+    ta_free(arr[0]);
+    ta_free(arr[n - 1]);
+    n -= 2;
+    memmove(arr, arr + 1, n * sizeof(void *));
+    check_order(__unit, tactx, arr, n);
+
+    // Moving chunks keeps their place.
+    for (size_t i = 0; i < n; i += 7)
+        arr[i] = ta_asprintf_append((char *)arr[i], "%4096s", "");
+    check_order(__unit, tactx, arr, n);
+
+    // Children moved from another parent come after the existing ones.
+    for (size_t i = 0; i < N; ++i) {
+        memmove(arr + n + 1, arr + n, i * sizeof(void *));
+        arr[n] = ta_alloc(other, 0);
+    }
+    ta_move_children(other, tactx);
+    n += N;
+    check_order(__unit, tactx, arr, n);
+    assert_null(ta_get_child(other));
+
+    // Reparented children come first.
+    for (size_t i = n; i-- > n / 2;) {
+        void *ptr = arr[n - 1];
+        memmove(arr + 1, arr, (n - 1) * sizeof(void *));
+        arr[0] = ta_set_parent(ptr, other);
+        ta_set_parent(ptr, tactx);
+    }
+    check_order(__unit, tactx, arr, n);
+
+    // Shrink back below the array threshold.
+    while (n > 10) {
+        ta_free(arr[n / 2]);
+        memmove(arr + n / 2, arr + n / 2 + 1, (n - n / 2 - 1) * sizeof(void *));
+        n--;
+    }
+    check_order(__unit, tactx, arr, n);
+
+    for (size_t i = 0; i < N; ++i)
+        arr[N + i] = ta_alloc(other, 0);
+    ta_move_children(tactx, other);
+    check_order(__unit, tactx, arr, 0);
+    assert_equal(check_children(__unit, other), N + n);
+
+    ta_free_children(other);
+    check_order(__unit, other, arr, 0);
+    for (size_t i = 0; i < N; ++i)
+        arr[i] = ta_alloc(tactx, 0);
+    ta_free_children(tactx);
+    check_order(__unit, tactx, arr, 0);
+
+    ta_free(arr);
+    ta_free(other);
+    ta_free(tactx);
+}
+
 TEST(test_ta_alloc)
 {
     void *tactx = ta_alloc(NULL, 0);
@@ -626,6 +1046,136 @@ TEST(test_ta_zalloc)
     ta_free(tactx);
 }
 
+TEST(test_ta_alloc_many)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    void *other = ta_alloc(NULL, 0);
+    void *old = ta_alloc(tactx, 0);
+    void *arr[100];
+
+    // The chunks are linked as if allocated one by one.
+    ta_alloc_many(tactx, 40, 100, arr);
+    assert_equal(ta_get_child_count(tactx), 101);
+    assert_equal(ta_get_child(tactx), arr[99]);
+    for (size_t i = 0; i < 100; ++i) {
+        assert_equal(ta_get_size(arr[i]), 40);
+        assert_equal(ta_get_parent(arr[i]), tactx);
+        assert_equal(ta_get_next(arr[i]), i ? arr[i - 1] : old);
+        memset(arr[i], (int)i, 40);
+    }
+#if !defined(TA_BACKLINKS) || TA_BACKLINKS
+    assert_equal(ta_get_prev(old), arr[0]);
+    assert_equal(ta_get_prev(arr[0]), arr[1]);
+    assert_null(ta_get_prev(arr[99]));
+#endif
+    assert_true(ta_has_child(tactx, arr[50]));
+
+    size_t i = 0;
+    void *ptr;
+    TA_FOREACH(ptr, tactx) {
+        assert_equal(ta_get_child_at(tactx, i), ptr);
+        i++;
+    }
+    assert_equal(i, 101);
+
+    // They are independent chunks, and their children do not share their block.
+    char *str = ta_strdup(arr[5], "child");
+    assert_null(ta_get_allocator(str));
+    arr[3] = ta_realloc(tactx, arr[3], 1000);
+    assert_equal(((char *)arr[3])[39], 3);
+    ta_set_parent(arr[7], other);
+    assert_equal(ta_get_child_count(other), 1);
+    ta_free(arr[0]);
+    arr[0] = NULL;
+
+    for (i = 1; i < 100; ++i)
+        assert_equal(((char *)arr[i])[39], (char)i);
+
+    ta_free_many(arr, 100);
+    assert_equal(ta_get_child_count(tactx), 1);
+    assert_equal(ta_get_child(tactx), old);
+    assert_null(ta_get_child(other));
+
+    // Wide parents get their children indexed either way.
+    void *many[50];
+    for (size_t round = 0; round < 3; ++round) {
+        ta_alloc_many(tactx, 300, 50, many);
+        ta_alloc_many(tactx, 0, 1, many);
+    }
+    assert_equal(ta_get_child_count(tactx), 154);
+    i = 0;
+    TA_FOREACH(ptr, tactx) {
+        assert_equal(ta_get_child_at(tactx, i), ptr);
+        i++;
+    }
+    assert_equal(i, 154);
+    ta_free_children(tactx);
+
+    // Runs of siblings allocated one by one are unlinked at once wherever they are
+    // in the list, chunks of other parents in between are freed on their own.
+    void *loose[40], *doomed[40];
+    for (i = 0; i < 40; ++i) {
+        loose[i] = ta_alloc(i % 10 == 9 ? other : tactx, i);
+        assert_str_equal(ta_strdup(loose[i], "child"), "child");
+        bool free = i < 5 || (i >= 12 && i < 18) || (i % 10 == 9 && i != 19) || i >= 30;
+        doomed[i] = free ? loose[i] : NULL;
+    }
+    ta_free_many(doomed, 40);
+
+    static const size_t kept[] = { 28, 27, 26, 25, 24, 23, 22, 21, 20, 18, 11, 10, 8, 7, 6, 5 };
+    assert_equal(ta_get_child_count(tactx), 16);
+    i = 0;
+    TA_FOREACH(ptr, tactx) {
+        assert_equal(ptr, loose[kept[i]]);
+#if !defined(TA_BACKLINKS) || TA_BACKLINKS
+        assert_equal(ta_get_prev(ptr), i ? loose[kept[i - 1]] : NULL);
+#endif
+        assert_equal(ta_get_child_at(tactx, i), ptr);
+        i++;
+    }
+    assert_equal(i, 16);
+    assert_equal(ta_get_child(other), loose[19]);
+    assert_equal(ta_get_child_count(other), 1);
+
+    // A run at the tail leaves the link to the new last child behind.
+    ta_free_many(loose + 5, 4);
+    assert_equal(ta_get_child_count(tactx), 12);
+    assert_equal(ta_get_child(tactx), loose[28]);
+    assert_equal(ta_get_child_at(tactx, 11), loose[10]);
+    assert_null(ta_get_next(loose[10]));
+#if !defined(TA_BACKLINKS) || TA_BACKLINKS
+    ptr = loose[10];
+    i = 0;
+    TA_FOREACH_REVERSE_FROM(ptr, tactx) {
+        i++;
+    }
+    assert_equal(i, 12);
+#endif
+    assert_equal(ta_get_size(ta_alloc(tactx, 0)), 0);
+    ta_free(loose[10]);
+    assert_equal(ta_get_child_at(tactx, 11), loose[11]);
+    ta_free_children(tactx);
+    ta_free_children(other);
+
+    // Chunks without a parent, and chunks on an allocator.
+    ta_alloc_many(NULL, 16, 4, many);
+    for (i = 0; i < 4; ++i)
+        assert_null(ta_get_parent(many[i]));
+    ta_free_many(many, 4);
+
+    void *arena = ta_arena_new(tactx, 0);
+    ta_alloc_many(arena, 100, 10, many);
+    assert_equal(ta_get_allocator(many[9]), ta_get_allocator(arena));
+    ta_free_many(many, 10);
+    assert_null(ta_get_child(arena));
+
+    ta_alloc_many(tactx, 8, 0, NULL);
+    ta_free_many(NULL, 0);
+
+    ta_free(other);
+    ta_free(tactx);
+}
+
 TEST(test_ta_realloc)
 {
     void *tactx = ta_alloc(NULL, 0);
@@ -710,6 +1260,48 @@ TEST(test_ta_realloc)
     ta_free(tactx);
 }
 
+TEST(test_ta_realloc_huge)
+{
+    void *tactx = ta_alloc(NULL, 0);
+
+    // Big chunks keep their contents and children while growing and shrinking,
+    // across the threshold of mapped chunks as well.
+    size_t size = 1000;
+    char *buf = (char *)ta_alloc(tactx, size);
+    memset(buf, 1, size);
+    void *child = ta_alloc(buf, 10);
+
+    for (size_t step = 1; step <= 14; ++step) {
+        buf = (char *)ta_realloc(tactx, buf, size * 2);
+        assert_equal(buf[0], (char)step);
+        assert_equal(buf[size - 1], (char)step);
+        assert_equal(ta_get_parent(child), buf);
+        size *= 2;
+        memset(buf, (int)step + 1, size);
+    }
+    assert_equal(ta_get_size(buf), (size_t)1000 << 14);
+
+    buf = (char *)ta_realloc(tactx, buf, 1000);
+    assert_equal(buf[999], 15);
+    assert_equal(ta_get_parent(child), buf);
+    ta_free(buf);
+
+    char *zero = (char *)ta_zalloc(tactx, (size_t)4 << 20);
+    assert_equal(zero[0], 0);
+    assert_equal(zero[((size_t)4 << 20) - 1], 0);
+    ta_free(zero);
+
+    char *piece = (char *)ta_alloc(tactx, 65536);
+    memset(piece, 'x', 65536);
+    char *str = ta_strdup(tactx, "");
+    for (size_t i = 0; i < 32; ++i)
+        str = ta_strndup_append_buffer(str, piece, 65536);
+    assert_equal(strlen(str), (size_t)32 * 65536);
+    assert_equal(str[32 * 65536 - 1], 'x');
+
+    ta_free(tactx);
+}
+
 TEST(test_ta_memdup)
 {
     void *tactx = ta_alloc(NULL, 0);
@@ -1413,6 +2005,7 @@ TEST(test_ta_asprintf_append_buffer)
     ta_free(tactx);
 }
 
+#if !defined(TA_DESTRUCTORS) || TA_DESTRUCTORS
 struct ctx {
     int *a;
 };
@@ -1435,6 +2028,328 @@ TEST(test_ta_destructor)
     assert_equal(a, 2);
 }
 
+TEST(test_ta_destructor_realloc)
+{
+    int a[10];
+    struct ctx *arr[10];
+
+    void *tactx = ta_alloc(NULL, 0);
+    for (size_t i = 0; i < 10; ++i) {
+        a[i] = 1;
+        arr[i] = (struct ctx *)ta_alloc(tactx, sizeof(struct ctx));
+        arr[i]->a = &a[i];
+        assert_null(ta_set_destructor(arr[i], ctx_destructor));
+    }
+
+    for (size_t i = 0; i < 10; i += 2) {
+        arr[i] = (struct ctx *)ta_realloc(tactx, arr[i], 4096);
+        assert_equal(ta_get_destructor(arr[i]), ctx_destructor);
+        assert_equal(ta_get_size(arr[i]), 4096);
+    }
+
+    assert_equal(ta_set_destructor(arr[1], NULL), ctx_destructor);
+    assert_null(ta_get_destructor(arr[1]));
+
+    ta_free(arr[3]);
+    assert_equal(a[3], 2);
+
+    ta_free(tactx);
+    for (size_t i = 0; i < 10; ++i)
+        assert_equal(a[i], i == 1 ? 1 : 2);
+}
+
+struct node {
+    void **log;
+    size_t *count;
+    void *sibling;
+};
+
+static void node_destructor(void *ptr)
+{
+    struct node *node = (struct node *)ptr;
+    node->log[(*node->count)++] = ptr;
+
+    // Destructors may still free their siblings and grow their own subtree.
+    if (node->sibling) {
+        ta_free(node->sibling);
+        struct node *child = (struct node *)ta_zalloc(ptr, sizeof(struct node));
+        child->log = node->log;
+        child->count = node->count;
+        ta_set_destructor(child, node_destructor);
+    }
+}
+
+static struct node *node_new(void *tactx, void **log, size_t *count)
+{
+    struct node *node = (struct node *)ta_zalloc(tactx, sizeof(struct node));
+    node->log = log;
+    node->count = count;
+    ta_set_destructor(node, node_destructor);
+    return node;
+}
+
+TEST(test_ta_destructor_order)
+{
+    void *log[8];
+    size_t count = 0;
+
+    struct node *root = node_new(NULL, log, &count);
+    struct node *d = node_new(root, log, &count);
+    struct node *c = node_new(root, log, &count);
+    struct node *a = node_new(root, log, &count);
+    struct node *b = node_new(a, log, &count);
+    c->sibling = d;
+
+    ta_free(root);
+    assert_equal(count, 6);
+    assert_equal(log[0], root);
+    assert_equal(log[1], a);
+    assert_equal(log[2], b);
+    assert_equal(log[3], c);
+    assert_equal(log[4], d);
+
+    count = 0;
+    root = node_new(NULL, log, &count);
+    d = node_new(root, log, &count);
+    c = node_new(root, log, &count);
+    c->sibling = d;
+
+    ta_free_children(root);
+    assert_equal(count, 3);
+    assert_equal(log[0], c);
+    assert_equal(log[1], d);
+    assert_null(ta_get_child(root));
+
+    ta_set_destructor(root, NULL);
+    ta_free(root);
+    assert_equal(count, 3);
+}
+
+TEST(test_ta_destructor_subtree)
+{
+    int a[4] = { 1, 1, 1, 1 };
+    void *tactx = ta_alloc(NULL, 0);
+    void *deep = tactx;
+    for (size_t i = 0; i < 10; ++i)
+        deep = ta_alloc(deep, 0);
+
+    // Set after the subtree is built.
+    struct ctx *ctx = (struct ctx *)ta_alloc(deep, sizeof(struct ctx));
+    ctx->a = &a[0];
+    ta_set_destructor(ctx, ctx_destructor);
+
+    // Reparented into a subtree without destructors.
+    void *other = ta_alloc(NULL, 0);
+    void *plain = ta_alloc(ta_alloc(other, 0), 0);
+    ctx = (struct ctx *)ta_alloc(NULL, sizeof(struct ctx));
+    ctx->a = &a[1];
+    ta_set_destructor(ctx, ctx_destructor);
+    ta_set_parent(ta_set_parent(ta_alloc(ctx, 0), NULL), plain);
+    ta_set_parent(ctx, plain);
+
+    // Moved into a subtree without destructors.
+    void *src = ta_alloc(NULL, 0);
+    ctx = (struct ctx *)ta_alloc(ta_alloc(src, 0), sizeof(struct ctx));
+    ctx->a = &a[2];
+    ta_set_destructor(ctx, ctx_destructor);
+    ctx = (struct ctx *)ta_alloc(src, sizeof(struct ctx));
+    ctx->a = &a[3];
+    ta_set_destructor(ctx, ctx_destructor);
+    ta_move_children(src, ta_alloc(ta_alloc(other, 0), 0));
+    ta_free(src);
+
+    // Cleared destructors leave nothing behind.
+    ta_set_destructor(ta_alloc(deep, 0), ctx_destructor);
+    ta_set_destructor(ta_get_child(deep), NULL);
+
+    ta_free(tactx);
+    assert_equal(a[0], 2);
+    assert_equal(a[1], 1);
+    ta_free(other);
+    assert_equal(a[1], 2);
+    assert_equal(a[2], 2);
+    assert_equal(a[3], 2);
+}
+#else
+TEST(test_ta_no_destructors)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    void *ptr = ta_alloc(tactx, 0);
+    assert_null(ta_get_destructor(ptr));
+    assert_null(ta_set_destructor(ptr, NULL));
+    assert_null(ta_get_destructor(ptr));
+    ta_free(tactx);
+}
+#endif
+
+#if defined(TA_NAMES) && TA_NAMES
+// Checks that every child named "<i>" for i < n is found, or none if `arr[i]` is NULL.
+static void check_names(const char *__unit, void *tactx, void **arr, size_t n)
+{
+    char name[32];
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(name, sizeof(name), "%zu", i);
+        assert_equal(ta_find_child(tactx, name), arr[i]);
+    }
+    assert_null(ta_find_child(tactx, "none"));
+}
+
+#if !defined(TA_DESTRUCTORS) || TA_DESTRUCTORS
+static size_t names_found;
+
+static void name_destructor(void *ptr)
+{
+    names_found += ta_find_child(ta_get_parent(ptr), ta_get_name(ptr)) == ptr;
+}
+#endif
+
+TEST(test_ta_names)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    void *other = ta_alloc(NULL, 0);
+    void *arr[100];
+    char name[32];
+
+    void *ptr = ta_alloc(tactx, 0);
+    assert_null(ta_get_name(ptr));
+    assert_null(ta_find_child(tactx, "ptr"));
+
+    // Names are copied.
+    strcpy(name, "ptr");
+    assert_str_equal(ta_set_name(ptr, name), "ptr");
+    strcpy(name, "tmp");
+    assert_str_equal(ta_get_name(ptr), "ptr");
+    assert_equal(ta_find_child(tactx, "ptr"), ptr);
+    assert_str_equal(ta_set_name(ptr, ta_get_name(ptr)), "ptr");
+    assert_null(ta_set_name(ptr, NULL));
+    assert_null(ta_find_child(tactx, "ptr"));
+    ta_free(ptr);
+
+    // Only some children are named, so the index outgrows the named ones.
+    for (size_t i = 0; i < 100; ++i) {
+        arr[i] = ta_alloc(tactx, 0);
+        assert_equal(ta_get_parent(ta_alloc(tactx, 0)), tactx);
+        snprintf(name, sizeof(name), "%zu", i);
+        ta_set_name(arr[i], name);
+        if (i % 10 == 0)
+            check_names(__unit, tactx, arr, i + 1);
+    }
+
+    for (size_t i = 0; i < 100; i += 7) {
+        ta_free(arr[i]);
+        arr[i] = NULL;
+    }
+    check_names(__unit, tactx, arr, 100);
+
+    ta_set_parent(arr[1], other);
+    ta_set_name(arr[2], "renamed");
+    arr[3] = ta_asprintf_append((char *)arr[3], "%4096s", "");
+    arr[4] = ta_realloc(tactx, arr[4], 8192);
+    assert_equal(ta_find_child(other, "1"), arr[1]);
+    assert_equal(ta_find_child(tactx, "renamed"), arr[2]);
+    arr[1] = arr[2] = NULL;
+    check_names(__unit, tactx, arr, 100);
+
+    ta_move_children(other, tactx);
+    assert_null(ta_find_child(other, "1"));
+    assert_str_equal(ta_get_name(ta_find_child(tactx, "1")), "1");
+
+    // Moved into an indexed parent and shrunk below the threshold.
+    ta_move_children(tactx, other);
+    assert_not_null(ta_find_child(other, "renamed"));
+    ta_free_children(other);
+    assert_null(ta_find_child(other, "renamed"));
+    for (size_t i = 0; i < 20; ++i)
+        ta_set_name(ta_alloc(other, 0), "dup");
+    assert_str_equal(ta_get_name(ta_find_child(other, "dup")), "dup");
+    while (ta_get_child_count(other) > 2)
+        ta_free(ta_get_child(other));
+    assert_str_equal(ta_get_name(ta_find_child(other, "dup")), "dup");
+
+#if !defined(TA_DESTRUCTORS) || TA_DESTRUCTORS
+    // Destructors may index the parent while its children are freed.
+    for (size_t i = 0; i < 20; ++i) {
+        ptr = ta_alloc(other, 0);
+        snprintf(name, sizeof(name), "%zu", i);
+        ta_set_name(ptr, name);
+        ta_set_destructor(ptr, name_destructor);
+    }
+    ta_free_children(other);
+    assert_equal(names_found, 20);
+#endif
+
+    ta_free(other);
+    ta_free(tactx);
+}
+#else
+TEST(test_ta_names)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    void *ptr = ta_alloc(tactx, 0);
+    assert_null(ta_get_name(ptr));
+    assert_null(ta_set_name(ptr, NULL));
+    assert_null(ta_find_child(tactx, "ptr"));
+    ta_free(tactx);
+}
+#endif
+
+TEST(test_ta_free_deep)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    void *ptr = tactx;
+
+    // Deep enough to overflow the stack with one frame per level.
+    for (size_t i = 0; i < 1000000; ++i)
+        ptr = ta_alloc(ptr, 0);
+
+    assert_true(ta_has_parent(ptr, tactx));
+    ta_free_children(tactx);
+    assert_null(ta_get_child(tactx));
+
+    ptr = tactx;
+    for (size_t i = 0; i < 1000000; ++i)
+        ptr = ta_alloc(ptr, 0);
+
+    ta_free(tactx);
+}
+
+#if defined(TA_OUTLINE) && TA_OUTLINE
+TEST(test_ta_outline)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    void *arr[100];
+
+    for (size_t i = 0; i < 100; ++i) {
+        arr[i] = ta_alloc(tactx, i);
+        assert_equal((uintptr_t)arr[i] % _Alignof(max_align_t), 0);
+        memset(arr[i], (int)i, i);
+    }
+
+    // Look the chunks up in an order that defeats the last header hint.
+    for (size_t i = 0; i < 100; i += 2) {
+        assert_equal(ta_get_size(arr[99 - i]), 99 - i);
+        assert_equal(ta_get_size(arr[i]), i);
+        assert_equal(ta_get_parent(arr[i]), tactx);
+    }
+
+    char *buf = (char *)ta_xmalloc(16);
+    memcpy(buf, "hello", 6);
+    buf = (char *)ta_assign(tactx, buf, 16);
+    assert_equal((uintptr_t)buf % _Alignof(max_align_t), 0);
+    assert_str_equal(buf, "hello");
+    assert_equal(ta_get_parent(buf), tactx);
+
+    for (size_t i = 0; i < 100; ++i) {
+        arr[i] = ta_realloc(tactx, arr[i], 4096 + i);
+        assert_equal((uintptr_t)arr[i] % _Alignof(max_align_t), 0);
+        for (size_t j = 0; j < i; ++j)
+            assert_equal(((uint8_t *)arr[i])[j], i);
+    }
+
+    ta_free(tactx);
+}
+#endif
+
 TEST(test_ta_foreach)
 {
     void *tactx = ta_alloc(NULL, 0);
@@ -1458,6 +2373,1280 @@ TEST(test_ta_foreach)
     ta_free(tactx);
 }
 
+#define WALK_MAX 256
+
+struct walk_log {
+    size_t n;
+    void *ptr[WALK_MAX];
+    size_t depth[WALK_MAX];
+    bool leaving[WALK_MAX];
+};
+
+static void walk_log_add(struct walk_log *log, void *ptr, size_t depth, bool leaving)
+{
+    if (log->n < WALK_MAX) {
+        log->ptr[log->n] = ptr;
+        log->depth[log->n] = depth;
+        log->leaving[log->n] = leaving;
+    }
+    log->n++;
+}
+
+static void walk_reference(struct walk_log *log, void *ptr, size_t depth, bool post)
+{
+    walk_log_add(log, ptr, depth, false);
+
+    void *child;
+    TA_FOREACH(child, ptr) {
+        walk_reference(log, child, depth + 1, post);
+    }
+
+    if (post)
+        walk_log_add(log, ptr, depth, true);
+}
+
+static void check_walk_log(const char *__unit,
+                           const struct walk_log *log, const struct walk_log *ref)
+{
+    assert_equal(log->n, ref->n);
+    assert_true(log->n <= WALK_MAX);
+
+    for (size_t i = 0; i < ref->n; ++i) {
+        assert_equal(log->ptr[i], ref->ptr[i]);
+        assert_equal(log->depth[i], ref->depth[i]);
+        assert_equal(log->leaving[i], ref->leaving[i]);
+    }
+}
+
+static int walk_pre(void *ptr, size_t depth, void *user)
+{
+    walk_log_add((struct walk_log *)user, ptr, depth, false);
+    return TA_WALK_CONTINUE;
+}
+
+static int walk_post(void *ptr, size_t depth, void *user)
+{
+    walk_log_add((struct walk_log *)user, ptr, depth, true);
+    return TA_WALK_CONTINUE;
+}
+
+static int walk_skip(void *ptr, size_t depth, void *user)
+{
+    walk_log_add((struct walk_log *)user, ptr, depth, false);
+    return depth == 1 && ta_get_size(ptr) % 2 ? TA_WALK_SKIP : TA_WALK_CONTINUE;
+}
+
+static int walk_stop(void *ptr, size_t depth, void *user)
+{
+    walk_log_add((struct walk_log *)user, ptr, depth, false);
+    return ((struct walk_log *)user)->n == 10 ? TA_WALK_STOP : TA_WALK_CONTINUE;
+}
+
+static int walk_free_pre(void *ptr, size_t depth, void *user)
+{
+    (void)user;
+    if (depth == 1 && ta_get_size(ptr) % 2) {
+        ta_free(ptr);
+        return TA_WALK_SKIP;
+    }
+    return TA_WALK_CONTINUE;
+}
+
+static int walk_free_continue(void *ptr, size_t depth, void *user)
+{
+    walk_log_add((struct walk_log *)user, ptr, depth, false);
+    if (depth == 1 && ta_get_size(ptr) % 2)
+        ta_free(ptr);
+    return TA_WALK_CONTINUE;
+}
+
+static int walk_free_post(void *ptr, size_t depth, void *user)
+{
+    (void)user;
+    if (depth == 2)
+        ta_free(ptr);
+    return TA_WALK_CONTINUE;
+}
+
+TEST(test_ta_walk)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    assert_not_null(tactx);
+
+    // Wide enough for a child array, with a few grandchildren and a chain.
+    for (size_t i = 0; i < 40; ++i) {
+        void *ptr = ta_alloc(tactx, i);
+        for (size_t j = 0; j < i % 3; ++j)
+            assert_equal(ta_get_parent(ta_alloc(ptr, j)), ptr);
+        if (i == 5) {
+            for (size_t j = 0; j < 3; ++j)
+                ptr = ta_alloc(ptr, 0);
+        }
+    }
+
+    struct walk_log ref = {0}, log = {0};
+    walk_reference(&ref, tactx, 0, true);
+    assert_true(ta_walk(tactx, walk_pre, walk_post, &log));
+    check_walk_log(__unit, &log, &ref);
+
+    struct ta_walker w;
+    memset(&log, 0, sizeof(log));
+    ta_walker_init(&w, tactx, true);
+    while (ta_walker_next(&w))
+        walk_log_add(&log, w.ptr, w.depth, w.leaving);
+    check_walk_log(__unit, &log, &ref);
+    assert_null(ta_walker_next(&w));
+
+    memset(&ref, 0, sizeof(ref));
+    memset(&log, 0, sizeof(log));
+    walk_reference(&ref, tactx, 0, false);
+    assert_true(ta_walk(tactx, walk_pre, NULL, &log));
+    check_walk_log(__unit, &log, &ref);
+
+    memset(&log, 0, sizeof(log));
+    ta_walker_init(&w, tactx, false);
+    while (ta_walker_next(&w))
+        walk_log_add(&log, w.ptr, w.depth, w.leaving);
+    check_walk_log(__unit, &log, &ref);
+
+    // Children of odd sized chunks are skipped, the chunks themselves are not.
+    memset(&log, 0, sizeof(log));
+    assert_true(ta_walk(tactx, walk_skip, walk_post, &log));
+    size_t skipped = 0, n = 0;
+    for (size_t i = 0; i < ref.n; ++i) {
+        void *ptr = ref.ptr[i];
+        for (size_t depth = ref.depth[i]; depth > 1; --depth)
+            ptr = ta_get_parent(ptr);
+        skipped += ref.depth[i] > 1 && ta_get_size(ptr) % 2;
+    }
+    for (size_t i = 0; i < log.n; ++i)
+        n += !log.leaving[i];
+    assert_equal(n, ref.n - skipped);
+    assert_equal(log.n, 2 * n - 20);
+
+    memset(&log, 0, sizeof(log));
+    assert_false(ta_walk(tactx, walk_stop, NULL, &log));
+    assert_equal(log.n, 10);
+
+    memset(&log, 0, sizeof(log));
+    assert_true(ta_walk(ta_get_child(tactx), walk_pre, walk_post, &log));
+    assert_true(log.n >= 2);
+    assert_equal(log.ptr[0], ta_get_child(tactx));
+    assert_equal(log.ptr[log.n - 1], ta_get_child(tactx));
+
+    assert_true(ta_walk(tactx, walk_free_pre, NULL, NULL));
+    assert_equal(ta_get_child_count(tactx), 20);
+    assert_true(ta_walk(tactx, NULL, walk_free_post, NULL));
+
+    void *ptr;
+    TA_FOREACH(ptr, tactx) {
+        assert_equal(ta_get_size(ptr) % 2, 0);
+        assert_equal(ta_get_child_count(ptr), 0);
+    }
+
+    // A freed chunk is skipped even if the callback carries on.
+    for (size_t i = 0; i < 4; ++i) {
+        ptr = ta_alloc(tactx, 1);
+        for (size_t j = 0; j < 3; ++j)
+            assert_equal(ta_get_parent(ta_alloc(ptr, j)), ptr);
+    }
+    memset(&log, 0, sizeof(log));
+    assert_true(ta_walk(tactx, walk_free_continue, walk_post, &log));
+    assert_equal(log.n, 1 + 24 + 1 + 20);
+    assert_equal(ta_get_child_count(tactx), 20);
+
+    // The walker frees in the same way.
+    for (size_t i = 0; i < 10; ++i)
+        assert_equal(ta_get_size(ta_alloc(ta_get_child(tactx), i)), i);
+    ta_walker_init(&w, tactx, false);
+    while (ta_walker_next(&w)) {
+        if (w.depth == 2) {
+            ta_walker_skip(&w);
+            ta_free(w.ptr);
+        }
+    }
+    assert_equal(ta_get_child_count(ta_get_child(tactx)), 0);
+
+    ta_walker_init(&w, tactx, true);
+    assert_equal(ta_walker_next(&w), tactx);
+    ta_walker_skip(&w);
+    assert_null(ta_walker_next(&w));
+
+    ta_free(tactx);
+}
+
+// Backing allocator on top of libc which counts its blocks and bytes.
+struct test_heap {
+    size_t blocks;
+    size_t bytes;
+    size_t resized;
+};
+
+static void *test_heap_alloc(void *ctx, size_t size)
+{
+    struct test_heap *heap = (struct test_heap *)ctx;
+    heap->blocks++;
+    heap->bytes += size;
+    return malloc(size);
+}
+
+static void *test_heap_zalloc(void *ctx, size_t size)
+{
+    struct test_heap *heap = (struct test_heap *)ctx;
+    heap->blocks++;
+    heap->bytes += size;
+    return calloc(1, size);
+}
+
+static void *test_heap_resize(void *ctx, void *ptr, size_t old_size, size_t size)
+{
+    struct test_heap *heap = (struct test_heap *)ctx;
+    heap->resized++;
+    heap->bytes += size - old_size;
+    return realloc(ptr, size);
+}
+
+static void test_heap_release(void *ctx, void *ptr, size_t size)
+{
+    struct test_heap *heap = (struct test_heap *)ctx;
+    heap->blocks--;
+    heap->bytes -= size;
+    free(ptr);
+}
+
+static void check_allocator(const char *__unit, const struct ta_allocator *allocator)
+{
+    struct test_heap *heap = (struct test_heap *)allocator->ctx;
+
+    void *tactx = ta_alloc(NULL, 8);
+    assert_null(ta_get_allocator(tactx));
+    memset(tactx, 0xAB, 8);
+
+    tactx = ta_set_allocator(tactx, allocator);
+    assert_equal(ta_get_allocator(tactx), allocator);
+    assert_equal(ta_set_allocator(tactx, allocator), tactx);
+    assert_equal(ta_get_size(tactx), 8);
+    assert_equal(((unsigned char *)tactx)[7], 0xAB);
+    assert_equal(heap->blocks, 1);
+
+    // Everything allocated under the context inherits its allocator.
+    void *ptr = ta_zalloc(tactx, 64);
+    for (size_t i = 0; i < 64; ++i)
+        assert_equal(((unsigned char *)ptr)[i], 0);
+
+    char *str = ta_strdup(ptr, "foo");
+    char *fmt = ta_asprintf(tactx, "%d", 42);
+    void *dup = ta_memdup(tactx, "bar", 4);
+    void *buf = ta_assign(tactx, ta_xstrdup("baz"), 4);
+    void *arr[] = { ptr, str, fmt, dup, buf, ta_strndup(str, "qux", 2), ta_alloc(NULL, 0) };
+    for (size_t i = 0; i < 6; ++i)
+        assert_equal(ta_get_allocator(arr[i]), allocator);
+    assert_null(ta_get_allocator(arr[6]));
+    assert_equal(heap->blocks, 7);
+    assert_str_equal(fmt, "42");
+    assert_str_equal((char *)buf, "baz");
+
+    str = ta_strdup_append(str, "-and-a-much-longer-tail");
+    assert_str_equal(str, "foo-and-a-much-longer-tail");
+    assert_equal(ta_get_parent(str), ptr);
+    assert_equal(ta_get_allocator(str), allocator);
+
+    // Reparented chunks keep their allocator and are released through it.
+    assert_equal(ta_set_parent(dup, arr[6]), dup);
+    assert_equal(ta_get_allocator(ta_alloc(dup, 0)), allocator);
+    assert_null(ta_get_allocator(ta_alloc(arr[6], 0)));
+    ta_free(arr[6]);
+    assert_equal(heap->blocks, 6);
+
+    // Moving a chunk back to libc keeps its links and contents.
+    size_t count = ta_get_child_count(tactx);
+    ptr = ta_set_allocator(ptr, NULL);
+    assert_null(ta_get_allocator(ptr));
+    assert_equal(ta_get_parent(ptr), tactx);
+    assert_equal(ta_get_child_count(tactx), count);
+    assert_equal(ta_get_parent(str), ptr);
+    assert_equal(ta_get_child(ptr), str);
+    assert_equal(((unsigned char *)ptr)[63], 0);
+    assert_null(ta_get_allocator(ta_alloc(ptr, 0)));
+    assert_equal(heap->blocks, 5);
+
+    ta_free(tactx);
+    assert_equal(heap->blocks, 0);
+    assert_equal(heap->bytes, 0);
+}
+
+TEST(test_ta_allocator)
+{
+    struct test_heap heap = {0};
+    struct ta_allocator allocator = {
+        .alloc   = test_heap_alloc,
+        .zalloc  = test_heap_zalloc,
+        .resize  = test_heap_resize,
+        .release = test_heap_release,
+        .ctx     = &heap,
+    };
+    check_allocator(__unit, &allocator);
+    assert_true(heap.resized > 0);
+
+    // Zeroing and resizing fall back to the required functions.
+    struct test_heap minimal_heap = {0};
+    struct ta_allocator minimal = {
+        .alloc   = test_heap_alloc,
+        .release = test_heap_release,
+        .ctx     = &minimal_heap,
+    };
+    check_allocator(__unit, &minimal);
+    assert_equal(minimal_heap.resized, 0);
+
+    // Chunks can move between allocators.
+    void *ptr = ta_set_allocator(ta_strdup(NULL, "foo"), &allocator);
+    assert_equal(ta_get_size(ta_alloc(ptr, 8)), 8);
+    ptr = ta_set_allocator(ptr, &minimal);
+    assert_equal(ta_get_allocator(ptr), &minimal);
+    assert_str_equal((char *)ptr, "foo");
+    assert_equal(heap.blocks, 1);
+    assert_equal(minimal_heap.blocks, 1);
+    ta_free(ptr);
+    assert_equal(heap.blocks, 0);
+    assert_equal(minimal_heap.blocks, 0);
+}
+
+#if !defined(TA_DESTRUCTORS) || TA_DESTRUCTORS
+static size_t test_arena_destroyed;
+
+static void test_arena_destructor(void *ptr)
+{
+    (void)ptr;
+    test_arena_destroyed++;
+}
+#endif
+
+TEST(test_ta_arena)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    void *arena = ta_arena_new(tactx, 0);
+    assert_equal(ta_get_parent(arena), tactx);
+    assert_equal(ta_get_size(arena), 0);
+    assert_not_null(ta_get_allocator(arena));
+
+    // Chunks are carved one after another and spill over to new blocks.
+    // They are aligned like chunks from libc.
+    uintptr_t align = (uintptr_t)tactx % _Alignof(max_align_t);
+    char *arr[1000];
+    for (size_t i = 0; i < 1000; ++i) {
+        arr[i] = (char *)ta_alloc(arena, 100);
+        memset(arr[i], (int)(i & 0x7F), 100);
+        assert_equal(ta_get_allocator(arr[i]), ta_get_allocator(arena));
+        assert_equal((uintptr_t)arr[i] % _Alignof(max_align_t), align);
+    }
+    assert_true(arr[1] > arr[0] && arr[1] - arr[0] < 256);
+    for (size_t i = 0; i < 1000; ++i)
+        assert_equal(arr[i][99], (char)(i & 0x7F));
+    assert_equal(ta_get_child_count(arena), 1000);
+
+    // Freeing a chunk runs its destructor, the last one is resized in place.
+#if !defined(TA_DESTRUCTORS) || TA_DESTRUCTORS
+    test_arena_destroyed = 0;
+    ta_set_destructor(arr[10], test_arena_destructor);
+    ta_free(arr[10]);
+    assert_equal(test_arena_destroyed, 1);
+#else
+    ta_free(arr[10]);
+#endif
+
+    char *last = (char *)ta_alloc(arena, 16);
+    assert_equal(ta_realloc(arena, last, 64), last);
+
+    char *str = ta_strdup(arena, "foo");
+    for (size_t i = 0; i < 100; ++i)
+        str = ta_strdup_append(str, "-bar");
+    assert_equal(strlen(str), 403);
+    assert_equal(ta_get_allocator(str), ta_get_allocator(arena));
+
+    // Large chunks get their own blocks.
+    char *large = (char *)ta_zalloc(arena, 100000);
+    assert_equal(large[99999], 0);
+    large = (char *)ta_realloc(arena, large, 200000);
+    large[199999] = 1;
+    large = (char *)ta_realloc(arena, large, 10);
+    ta_free(ta_alloc(arena, 50000));
+
+    // Chunks moved out of the arena stay where they are, along with their children.
+    char *ptr = ta_strdup(arena, "moved");
+    char *child = ta_strdup(ptr, "child");
+    void *libc = ta_set_allocator(ta_alloc(ptr, 0), NULL);
+    assert_null(ta_get_allocator(libc));
+    assert_str_equal(ta_strdup(libc, "grandchild"), "grandchild");
+
+    void *other = ta_alloc(NULL, 0);
+    assert_equal(ta_set_parent(ptr, other), ptr);
+    assert_equal(ta_get_allocator(ptr), ta_get_allocator(arena));
+    assert_equal(ta_get_parent(ptr), other);
+    assert_equal(ta_get_parent(child), ptr);
+
+    // So are chunks reallocated or moved as children to a parent off the arena.
+    char *realloced = (char *)ta_realloc(other, ta_strdup(arena, "realloced"), 10);
+    assert_equal(ta_get_allocator(realloced), ta_get_allocator(arena));
+    assert_str_equal(realloced, "realloced");
+
+    void *parent = ta_alloc(arena, 0);
+    char *first = ta_strdup(parent, "first");
+    char *second = ta_strdup(parent, "second");
+    ta_move_children(parent, other);
+    assert_equal(ta_get_child_count(other), 4);
+    assert_equal(ta_get_parent(first), other);
+    assert_equal(ta_get_parent(second), other);
+
+    // Moving chunks within the arena keeps them in place.
+    char *inner = ta_strdup(arena, "inner");
+    assert_equal(ta_set_parent(inner, arr[1]), inner);
+    assert_equal(ta_get_allocator(inner), ta_get_allocator(arena));
+
+    // A nested arena is freed with the outer one, an arena can be moved and resized.
+    void *nested = ta_arena_new(arr[2], 100);
+    assert_equal(ta_get_size(ta_alloc(nested, 1000)), 1000);
+    assert_true(ta_get_allocator(nested) != ta_get_allocator(arena));
+    assert_equal(ta_set_parent(arena, NULL), arena);
+    arena = ta_realloc(NULL, arena, 32);
+    assert_equal(ta_get_size(arena), 32);
+    assert_equal(ta_get_parent(arr[999]), arena);
+
+    // The chunks moved out outlive the arena, and new children of theirs are still
+    // carved from its blocks.
+    ta_free(arena);
+    ta_free(tactx);
+    assert_equal(ta_get_child_count(other), 4);
+    assert_str_equal(ptr, "moved");
+    assert_str_equal(child, "child");
+    assert_str_equal(first, "first");
+    assert_str_equal(second, "second");
+    assert_equal(ta_get_allocator(ta_strdup(ptr, "late")), ta_get_allocator(ptr));
+    ta_free(other);
+}
+
+#define assert_in_pool(ptr, pool, size) \
+    assert_true((char *)(ptr) > (char *)(pool) && (char *)(ptr) < (char *)(pool) + (size))
+
+TEST(test_ta_pool)
+{
+    void *tactx = ta_alloc(NULL, 0);
+    void *other = ta_alloc(NULL, 0);
+
+    void *pool = ta_pool(tactx, 2048);
+    assert_equal(ta_get_parent(pool), tactx);
+    assert_equal(ta_get_size(pool), 0);
+    assert_not_null(ta_get_allocator(pool));
+
+    // A struct with its strings takes one block.
+    char **obj = (char **)ta_zalloc_array(pool, sizeof(char *), 12);
+    assert_in_pool(obj, pool, 2048);
+    for (size_t i = 0; i < 12; ++i) {
+        obj[i] = ta_asprintf(obj, "string %zu", i);
+        assert_in_pool(obj[i], pool, 2048);
+        assert_equal(ta_get_allocator(obj[i]), ta_get_allocator(pool));
+    }
+
+    // The last chunk grows in place, others move out with their contents.
+    char *str = obj[11];
+    obj[11] = ta_strdup_append(obj[11], " and more");
+    assert_equal(obj[11], str);
+    obj[0] = (char *)ta_realloc(obj, obj[0], 100);
+    assert_str_equal(obj[0], "string 0");
+
+    // Once the pool is full, chunks come from libc.
+    char *big = (char *)ta_alloc(pool, 4000);
+    assert_false(big > (char *)pool && big < (char *)pool + 2048);
+    memset(big, 1, 4000);
+    big = (char *)ta_realloc(pool, big, 8000);
+    assert_equal(big[3999], 1);
+    ta_free(big);
+
+    // Chunks moved out of the pool stay where they are and keep it alive.
+    void *moved = ta_set_parent(obj, other);
+    assert_equal(moved, obj);
+    ta_free(pool);
+    for (size_t i = 1; i < 12; ++i) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "string %zu", i);
+        assert_strn_equal(obj[i], buf, strlen(buf));
+    }
+    assert_str_equal(ta_strdup(obj, "still on the pool"), "still on the pool");
+    ta_free(other);
+
+    // Children outlive the pool in either order.
+    pool = ta_pool(NULL, 0);
+    str = ta_strdup(pool, "first");
+    assert_str_equal(ta_strdup(str, "second"), "second");
+    ta_free(str);
+    ta_free(pool);
+
+    ta_free(tactx);
+}
+
+#define assert_in_buffer(ptr, buf) \
+    assert_true((char *)(ptr) >= (buf) && (char *)(ptr) < (buf) + sizeof(buf))
+
+TEST(test_ta_context_from_buffer)
+{
+    char buf[4096];
+    void *other = ta_alloc(NULL, 0);
+
+    // Chunks come from the buffer, even one that is not aligned.
+    void *tactx = ta_context_from_buffer(buf + 3, sizeof(buf) - 3);
+    assert_in_buffer(tactx, buf);
+    assert_null(ta_get_parent(tactx));
+    assert_not_null(ta_get_allocator(tactx));
+
+    char *path = ta_strdup(tactx, "/usr");
+    for (size_t i = 0; i < 10; ++i)
+        path = ta_asprintf_append(path, "/dir%zu", i);
+    assert_in_buffer(path, buf);
+    assert_str_equal(path, "/usr/dir0/dir1/dir2/dir3/dir4/dir5/dir6/dir7/dir8/dir9");
+
+    // Once it is full they come from the heap.
+    char *arr[100];
+    for (size_t i = 0; i < 100; ++i) {
+        arr[i] = (char *)ta_alloc(tactx, 100);
+        memset(arr[i], (int)i, 100);
+    }
+    assert_in_buffer(arr[0], buf);
+    assert_false(arr[99] >= buf && arr[99] < buf + sizeof(buf));
+    for (size_t i = 0; i < 100; ++i)
+        assert_equal(arr[i][99], (char)i);
+
+    struct ta_arena_stats stats;
+    assert_true(ta_get_arena_stats(tactx, &stats));
+    assert_true(stats.blocks > 1);
+
+    // Chunks moved out of the context keep their address, with their children too.
+    ta_set_parent(path, other);
+    assert_in_buffer(path, buf);
+    char *parent = ta_strdup(tactx, "parent");
+    char *first = ta_strdup(parent, "first");
+    ta_move_children(parent, other);
+    ta_move_children(tactx, other);
+    assert_null(ta_get_child(tactx));
+    assert_equal(ta_get_parent(first), other);
+    assert_equal(ta_get_parent(arr[99]), other);
+
+    // They outlive the context, those copied to the heap outlive the buffer too.
+    ta_free(tactx);
+    assert_str_equal(path, "/usr/dir0/dir1/dir2/dir3/dir4/dir5/dir6/dir7/dir8/dir9");
+    assert_str_equal(first, "first");
+    assert_equal(arr[99][99], 99);
+    path = (char *)ta_set_allocator(path, NULL);
+    assert_false(path >= buf && path < buf + sizeof(buf));
+    ta_set_parent(path, NULL);
+    ta_reset(other, 0);
+    ta_set_parent(path, other);
+
+    // The context can be made again over the same buffer.
+    tactx = ta_context_from_buffer(buf, sizeof(buf));
+    assert_in_buffer(ta_strdup(tactx, "again"), buf);
+    ta_free(tactx);
+
+    // Buffers too small for the context leave everything to the heap.
+    tactx = ta_context_from_buffer(buf, 16);
+    assert_false((char *)tactx >= buf && (char *)tactx < buf + sizeof(buf));
+    assert_str_equal(ta_strdup(tactx, "small"), "small");
+    ta_free(tactx);
+
+    tactx = ta_context_from_buffer(NULL, 0);
+    assert_str_equal(ta_strdup(tactx, "null"), "null");
+    ta_free(tactx);
+
+    assert_str_equal(path, "/usr/dir0/dir1/dir2/dir3/dir4/dir5/dir6/dir7/dir8/dir9");
+    ta_free(other);
+}
+
+#ifndef _WIN32
+TEST(test_ta_arena_map)
+{
+    struct ta_arena_stats stats;
+    void *tactx = ta_alloc(NULL, 0);
+    assert_false(ta_get_arena_stats(tactx, &stats));
+
+    void *plain = ta_arena_new(tactx, 0);
+    assert_true(ta_get_arena_stats(plain, &stats));
+    assert_equal(stats.blocks, 1);
+    assert_equal(stats.huge_bytes + stats.regular_bytes, 0);
+
+    // The first block is mapped and faulted in up front, in whole pages.
+    size_t size = (size_t)4 << 20;
+    void *arena = ta_arena_map(tactx, size, TA_ARENA_HUGE | TA_ARENA_PREFAULT);
+    assert_equal(ta_get_parent(arena), tactx);
+    assert_true(ta_get_arena_stats(arena, &stats));
+    assert_equal(stats.blocks, 1);
+    assert_true(stats.bytes >= size);
+    assert_true(stats.huge_bytes + stats.regular_bytes <= stats.bytes);
+#ifdef __linux__
+    assert_true(stats.huge_bytes + stats.regular_bytes >= size / 2);
+#endif
+
+    // Large chunks are carved from the reservation while it has room.
+    char *half = (char *)ta_alloc(arena, size / 2);
+    memset(half, 1, size / 2);
+    assert_equal(ta_realloc(arena, half, size / 2 + size / 4), half);
+    char *rest = (char *)ta_alloc(arena, size / 8);
+    memset(rest, 2, size / 8);
+    assert_true(ta_get_arena_stats(arena, &stats));
+    assert_equal(stats.blocks, 1);
+    ta_free(rest);
+    assert_equal(ta_realloc(arena, half, size / 4), half);
+    assert_equal(half[size / 4 - 1], 1);
+    ta_free(half);
+    assert_true(ta_get_arena_stats(arena, &stats));
+    assert_equal(stats.blocks, 1);
+
+    char *arr[1000];
+    for (size_t i = 0; i < 1000; ++i) {
+        arr[i] = (char *)ta_alloc(arena, 1000);
+        memset(arr[i], (int)(i & 0x7F), 1000);
+    }
+    assert_true(ta_get_arena_stats(arena, &stats));
+    assert_equal(stats.blocks, 1);
+
+    // Exhausted and large blocks are mapped with the same flags.
+    for (size_t i = 0; i < 5000; ++i)
+        assert_equal(ta_get_size(ta_alloc(arena, 1000)), 1000);
+    char *large = (char *)ta_zalloc(arena, size);
+    assert_equal(large[size - 1], 0);
+    assert_true(ta_get_arena_stats(arena, &stats));
+    assert_equal(stats.blocks, 3);
+
+    memcpy(large, "large", 6);
+    large = (char *)ta_realloc(arena, large, 2 * size);
+    large[2 * size - 1] = 1;
+    assert_str_equal(large, "large");
+    large = (char *)ta_realloc(arena, large, size + 1);
+    assert_str_equal(large, "large");
+    ta_free(large);
+    assert_true(ta_get_arena_stats(arena, &stats));
+    assert_equal(stats.blocks, 2);
+
+    for (size_t i = 0; i < 1000; ++i)
+        assert_equal(arr[i][999], (char)(i & 0x7F));
+
+    // Chunks moved out of the arena stay on its blocks.
+    char *str = ta_strdup(arena, "mapped");
+    ta_set_parent(str, tactx);
+    assert_equal(ta_get_allocator(str), ta_get_allocator(arena));
+    assert_str_equal(str, "mapped");
+
+    void *small = ta_arena_map(NULL, 0, 0);
+    assert_true(ta_get_arena_stats(small, &stats));
+    assert_true(stats.bytes >= 64 << 10);
+
+    // Large chunks of arenas without huge pages are remapped as they grow.
+    large = (char *)ta_alloc(small, 100000);
+    memcpy(large, "remapped", 9);
+    for (size_t grow = 1; grow <= 4; ++grow) {
+        large = (char *)ta_realloc(small, large, grow * size);
+        large[grow * size - 1] = 1;
+        assert_str_equal(large, "remapped");
+    }
+    large = (char *)ta_realloc(small, large, 100000);
+    assert_str_equal(large, "remapped");
+    ta_free(small);
+
+    ta_free(tactx);
+}
+#endif
+
+#if !defined(TA_DESTRUCTORS) || TA_DESTRUCTORS
+static void *test_aligned_destroyed;
+
+static void test_aligned_destructor(void *ptr)
+{
+    test_aligned_destroyed = ptr;
+}
+#endif
+
+#define assert_aligned(ptr, align) assert_equal((uintptr_t)(ptr) % (align), 0)
+
+TEST(test_ta_aligned)
+{
+    void *tactx = ta_alloc(NULL, 0);
+
+    for (size_t align = sizeof(void *); align <= 4096; align *= 2) {
+        unsigned char *ptr = (unsigned char *)ta_alloc_aligned(tactx, align, 100);
+        assert_aligned(ptr, align);
+        assert_equal(ta_get_size(ptr), 100);
+        assert_equal(ta_get_parent(ptr), tactx);
+        memset(ptr, 0xAB, 100);
+
+        unsigned char *zero = (unsigned char *)ta_zalloc_aligned(ptr, align, 300);
+        assert_aligned(zero, align);
+        for (size_t i = 0; i < 300; ++i)
+            assert_equal(zero[i], 0);
+
+        // Reallocations keep the alignment, the contents and the children.
+        for (size_t size = 1; size < 20000; size = size * 3 + 7) {
+            ptr = (unsigned char *)ta_realloc(tactx, ptr, size + 100);
+            assert_aligned(ptr, align);
+            assert_equal(ta_get_size(ptr), size + 100);
+            assert_equal(ptr[99], 0xAB);
+            assert_equal(ta_get_child(ptr), zero);
+            assert_equal(ta_get_parent(zero), ptr);
+        }
+        ptr = (unsigned char *)ta_realloc(tactx, ptr, 100);
+        assert_aligned(ptr, align);
+        assert_equal(ptr[0], 0xAB);
+
+        assert_aligned(ta_alloc_aligned(tactx, align, 0), align);
+        ta_free(ptr);
+    }
+
+    // The alignment of a chunk can be changed, also from and to plain chunks.
+    char *str = ta_strdup(tactx, "aligned");
+    size_t aligns[] = { 64, 4096, 16, 32, sizeof(void *), 128 };
+    for (size_t i = 0; i < sizeof(aligns) / sizeof(aligns[0]); ++i) {
+        str = (char *)ta_realloc_aligned(tactx, str, aligns[i], 8 + i);
+        assert_aligned(str, aligns[i]);
+        assert_equal(ta_get_size(str), 8 + i);
+        assert_str_equal(str, "aligned");
+    }
+    assert_aligned(ta_realloc_aligned(tactx, NULL, 64, 10), 64);
+
+    // Arrays are aligned as a whole.
+    uint64_t *arr = (uint64_t *)ta_alloc_array_aligned(tactx, 64, sizeof(uint64_t), 100);
+    assert_aligned(arr, 64);
+    assert_equal(ta_get_size(arr), 100 * sizeof(uint64_t));
+    arr[99] = 42;
+
+    // Moving to another parent or allocator keeps the alignment.
+    void *other = ta_alloc(NULL, 0);
+    assert_equal(ta_set_parent(arr, other), arr);
+    assert_equal(ta_get_parent(arr), other);
+
+    struct test_heap heap = {0};
+    struct ta_allocator allocator = {
+        .alloc   = test_heap_alloc,
+        .release = test_heap_release,
+        .ctx     = &heap,
+    };
+    arr = (uint64_t *)ta_set_allocator(arr, &allocator);
+    assert_aligned(arr, 64);
+    assert_equal(arr[99], 42);
+    assert_equal(heap.blocks, 1);
+
+    void *inherited = ta_alloc_aligned(arr, 256, 24);
+    assert_aligned(inherited, 256);
+    assert_equal(ta_get_allocator(inherited), &allocator);
+    inherited = ta_realloc(NULL, inherited, 5000);
+    assert_aligned(inherited, 256);
+    ta_free(inherited);
+
+    arr = (uint64_t *)ta_set_allocator(arr, NULL);
+    assert_aligned(arr, 64);
+    assert_equal(heap.blocks, 0);
+    assert_equal(heap.bytes, 0);
+
+    // Chunks carved from an arena are aligned and stay so when resized or moved.
+    void *arena = ta_arena_new(tactx, 0);
+    void *carved[64];
+    for (size_t i = 0; i < 64; ++i) {
+        carved[i] = ta_alloc_aligned(arena, 128, i);
+        assert_aligned(carved[i], 128);
+    }
+    carved[63] = ta_realloc(arena, carved[63], 1000);
+    assert_aligned(carved[63], 128);
+    memcpy(carved[63], "carved", 7);
+    ta_set_parent(carved[63], other);
+    assert_equal(ta_get_allocator(carved[63]), ta_get_allocator(arena));
+    assert_aligned(carved[63], 128);
+    assert_str_equal((char *)carved[63], "carved");
+
+    // Destructors get the aligned address.
+#if !defined(TA_DESTRUCTORS) || TA_DESTRUCTORS
+    test_aligned_destroyed = NULL;
+    void *destroyed = ta_alloc_aligned(other, 1024, 10);
+    ta_set_destructor(destroyed, test_aligned_destructor);
+    ta_free(other);
+    assert_equal(test_aligned_destroyed, destroyed);
+#else
+    ta_free(other);
+#endif
+
+    ta_free(tactx);
+}
+
+#if defined(TA_SLAB) && TA_SLAB
+// Allocates chunks of every slab class and frees every other one, the rest is
+// left to the caller.
+static void *test_slab_thread(void *arg)
+{
+    void **arr = (void **)arg;
+
+    for (size_t i = 0; i < 512; ++i) {
+        arr[i] = ta_alloc(NULL, i / 2);
+        memset(arr[i], (int)i, i / 2);
+    }
+    for (size_t i = 0; i < 512; i += 2)
+        ta_free(arr[i]);
+
+    return NULL;
+}
+
+TEST(test_ta_slab)
+{
+    // A freed block is the next one handed out from its class.
+    void *ptr = ta_alloc(NULL, 24);
+    ta_free(ptr);
+    void *again = ta_alloc(NULL, 20);
+    assert_equal(again, ptr);
+    ta_free(again);
+
+    // Chunks keep their contents while growing through the classes and beyond.
+    char *str = ta_strdup(NULL, "");
+    for (size_t i = 0; i < 400; ++i) {
+        str = ta_strdup_append(str, "x");
+        assert_equal(strlen(str), i + 1);
+    }
+    str = (char *)ta_realloc(NULL, str, 10);
+    assert_strn_equal(str, "xxxxxxxxxx", 10);
+    ta_free(str);
+
+    // Small buffers are copied into slabs.
+    char *buf = (char *)ta_assign(NULL, ta_xstrdup("foo"), 4);
+    assert_str_equal(buf, "foo");
+    ta_free(buf);
+
+    // Blocks move between threads, those of an exited thread are reused.
+    void *arr[512];
+    pthread_t thread;
+    assert_equal(pthread_create(&thread, NULL, test_slab_thread, arr), 0);
+    assert_equal(pthread_join(thread, NULL), 0);
+
+    for (size_t i = 1; i < 512; i += 2) {
+        if (i > 1)
+            assert_equal(((unsigned char *)arr[i])[i / 2 - 1], (unsigned char)i);
+        ta_free(arr[i]);
+    }
+
+    void *tactx = ta_alloc(NULL, 0);
+    for (size_t i = 0; i < 4096; ++i)
+        assert_equal(ta_get_size(ta_alloc(tactx, i % 200)), i % 200);
+    ta_free(tactx);
+}
+#endif
+
+#if defined(TA_CACHE) && TA_CACHE
+// Leaves freed chunks in the cache of the thread, which flushes it on exit.
+static void *test_cache_thread(void *arg)
+{
+    struct ta_cache_stats *stats = (struct ta_cache_stats *)arg;
+
+    for (size_t i = 0; i < 64; ++i)
+        ta_free(ta_alloc(NULL, 300 + i * 4));
+    for (size_t i = 0; i < 64; ++i)
+        ta_free(ta_alloc(NULL, 300 + i * 4));
+
+    ta_get_cache_stats(stats);
+    return NULL;
+}
+#endif
+
+TEST(test_ta_cache)
+{
+    struct ta_cache_stats stats;
+
+    ta_flush_cache();
+    if (!ta_get_cache_stats(&stats)) {
+        assert_equal(stats.hits, 0);
+        assert_equal(stats.blocks, 0);
+        return;
+    }
+    assert_equal(stats.blocks, 0);
+    assert_equal(stats.bytes, 0);
+
+    // A freed chunk is the next one handed out for its size.
+    struct ta_cache_stats prev = stats;
+    void *ptr = ta_alloc(NULL, 600);
+    ta_free(ptr);
+    assert_true(ta_get_cache_stats(&stats));
+    assert_equal(stats.frees, prev.frees + 1);
+    assert_equal(stats.blocks, 1);
+    assert_true(stats.bytes >= 600);
+
+    void *again = ta_zalloc(NULL, 600);
+    assert_equal(again, ptr);
+    for (size_t i = 0; i < 600; ++i)
+        assert_equal(((unsigned char *)again)[i], 0);
+    assert_true(ta_get_cache_stats(&stats));
+    assert_equal(stats.hits, prev.hits + 1);
+    assert_equal(stats.blocks, 0);
+    ta_free(again);
+
+    // Chunks keep their contents while growing through the cached sizes.
+    char *str = ta_strdup(NULL, "");
+    for (size_t i = 0; i < 1200; ++i) {
+        str = ta_strdup_append(str, "x");
+        assert_equal(strlen(str), i + 1);
+    }
+    str = (char *)ta_realloc(NULL, str, 500);
+    assert_strn_equal(str, "xxxxxxxxxx", 10);
+    ta_free(str);
+
+    // The cache holds a bounded number of chunks of a size.
+    void *arr[128];
+    for (size_t i = 0; i < 128; ++i)
+        arr[i] = ta_alloc(NULL, 700);
+    prev = stats;
+    assert_true(ta_get_cache_stats(&prev));
+    for (size_t i = 0; i < 128; ++i)
+        ta_free(arr[i]);
+    assert_true(ta_get_cache_stats(&stats));
+    assert_true(stats.blocks - prev.blocks <= 64);
+    assert_true(stats.evictions - prev.evictions >= 64);
+
+    // Freeing a parent caches its children too.
+    void *tactx = ta_alloc(NULL, 0);
+    for (size_t i = 0; i < 256; ++i)
+        assert_equal(ta_get_size(ta_alloc(tactx, 300 + i * 2)), 300 + i * 2);
+    ta_free(tactx);
+
+    ta_flush_cache();
+    assert_true(ta_get_cache_stats(&stats));
+    assert_equal(stats.blocks, 0);
+    assert_equal(stats.bytes, 0);
+    assert_true(stats.flushes >= 2);
+
+#if defined(TA_CACHE) && TA_CACHE
+    // Every thread has a cache of its own.
+    struct ta_cache_stats other;
+    pthread_t thread;
+    assert_equal(pthread_create(&thread, NULL, test_cache_thread, &other), 0);
+    assert_equal(pthread_join(thread, NULL), 0);
+    assert_true(other.hits >= 64);
+    assert_true(other.blocks > 0);
+
+    assert_true(ta_get_cache_stats(&prev));
+    assert_equal(prev.hits, stats.hits);
+    assert_equal(prev.blocks, 0);
+#endif
+}
+
+#if !defined(TA_DESTRUCTORS) || TA_DESTRUCTORS
+static size_t test_mark_destroyed;
+
+static void test_mark_destructor(void *ptr)
+{
+    (void)ptr;
+    test_mark_destroyed++;
+}
+#endif
+
+TEST(test_ta_mark)
+{
+    void *tactx = ta_alloc(NULL, 0);
+
+    // A mark of no children rolls back to none.
+    struct ta_mark mark = ta_mark(tactx);
+    for (size_t i = 0; i < 10; ++i)
+        assert_equal(ta_get_size(ta_alloc(tactx, 10)), 10);
+    ta_release_to(tactx, mark);
+    assert_null(ta_get_child(tactx));
+
+    // Only the children after the mark go, with their subtrees and destructors.
+    void *a = ta_alloc(tactx, 10);
+    void *b = ta_strdup(tactx, "kept");
+    mark = ta_mark(tactx);
+
+    for (size_t i = 0; i < 10; ++i) {
+        void *ptr = ta_alloc(tactx, 10);
+        assert_str_equal(ta_strdup(ptr, "dropped"), "dropped");
+#if !defined(TA_DESTRUCTORS) || TA_DESTRUCTORS
+        ta_set_destructor(ptr, test_mark_destructor);
+#endif
+    }
+    assert_equal(ta_get_size(ta_alloc(a, 10)), 10);
+
+#if !defined(TA_DESTRUCTORS) || TA_DESTRUCTORS
+    test_mark_destroyed = 0;
+#endif
+    ta_release_to(tactx, mark);
+    assert_equal(ta_get_child_count(tactx), 2);
+    assert_equal(ta_get_child(tactx), b);
+#if !defined(TA_DESTRUCTORS) || TA_DESTRUCTORS
+    assert_equal(test_mark_destroyed, 10);
+#endif
+
+    // Only direct children are rolled back, not the ones under older children.
+    assert_equal(ta_get_child_count(a), 1);
+
+    // Rolling back twice or to the present frees nothing.
+    ta_release_to(tactx, mark);
+    ta_release_to(tactx, ta_mark(tactx));
+    assert_equal(ta_get_child_count(tactx), 2);
+    assert_str_equal((char *)b, "kept");
+
+    // Older children freed in the meantime do not keep later ones alive.
+    ta_free(a);
+    void *x = ta_alloc(tactx, 10);
+    void *y = ta_alloc(tactx, 20);
+    assert_equal(ta_get_next(y), x);
+    ta_release_to(tactx, mark);
+    assert_equal(ta_get_child_count(tactx), 1);
+    assert_equal(ta_get_child(tactx), b);
+    a = ta_alloc(tactx, 10);
+    assert_equal(ta_get_next(a), b);
+
+    // The child at the mark may be freed or moved, the mark passes to the next one.
+    mark = ta_mark(tactx);
+    x = ta_alloc(tactx, 10);
+    ta_free(a);
+    ta_release_to(tactx, mark);
+    assert_equal(ta_get_child_count(tactx), 1);
+    assert_equal(ta_get_child(tactx), b);
+
+    mark = ta_mark(tactx);
+    b = ta_realloc(tactx, b, 100000);
+    x = ta_alloc(tactx, 10);
+    ta_release_to(tactx, mark);
+    assert_equal(ta_get_child_count(tactx), 1);
+    assert_equal(ta_get_child(tactx), b);
+    assert_str_equal((char *)b, "kept");
+
+    void *ptrs[2] = { b, ta_alloc(tactx, 10) };
+    mark = ta_mark(tactx);
+    ta_free_many(ptrs, 2);
+    ta_release_to(tactx, mark);
+    assert_null(ta_get_child(tactx));
+    b = ta_strdup(tactx, "kept");
+
+    // Nested marks roll back in turn, a mark whose child goes ends at an older one.
+    struct ta_mark outer = ta_mark(tactx);
+    x = ta_alloc(tactx, 10);
+    struct ta_mark inner = ta_mark(tactx);
+    y = ta_alloc(tactx, 10);
+    ta_release_to(tactx, inner);
+    assert_equal(ta_get_child(tactx), x);
+    y = ta_alloc(tactx, 10);
+    inner = ta_mark(tactx);
+    ta_free(y);
+    ta_free(x);
+    assert_equal(ta_get_size(ta_alloc(tactx, 10)), 10);
+    ta_release_to(tactx, inner);
+    assert_equal(ta_get_child(tactx), b);
+    assert_equal(ta_get_size(ta_alloc(tactx, 10)), 10);
+    ta_release_to(tactx, outer);
+    assert_equal(ta_get_child_count(tactx), 1);
+
+    // An arena carves the same memory again, across blocks.
+    struct ta_arena_stats stats;
+    void *arena = ta_arena_new(tactx, 4096);
+    char *str = ta_strdup(arena, "before");
+    mark = ta_mark(arena);
+
+    char *first = (char *)ta_alloc(arena, 200);
+    for (size_t i = 0; i < 100; ++i)
+        assert_equal(ta_get_size(ta_alloc(first, 200)), 200);
+    assert_true(ta_get_arena_stats(arena, &stats));
+    size_t blocks = stats.blocks;
+    assert_true(blocks > 2);
+
+    for (size_t cycle = 0; cycle < 3; ++cycle) {
+        ta_release_to(arena, mark);
+        assert_equal(ta_get_child(arena), str);
+
+        char *ptr = (char *)ta_alloc(arena, 200);
+        assert_equal(ptr, first);
+        for (size_t i = 0; i < 100; ++i)
+            assert_equal(ta_get_size(ta_alloc(ptr, 200)), 200);
+        assert_true(ta_get_arena_stats(arena, &stats));
+        assert_equal(stats.blocks, blocks);
+    }
+
+    // Also when grandchildren are carved after later children, which frees them
+    // out of order.
+    ta_release_to(arena, mark);
+    for (size_t i = 0; i < 2000; ++i) {
+        mark = ta_mark(arena);
+        void *ptr = ta_alloc(arena, 200);
+        assert_equal(ptr, first);
+        assert_equal(ta_get_size(ta_alloc(arena, 200)), 200);
+        assert_equal(ta_get_size(ta_alloc(ptr, 200)), 200);
+        ta_release_to(arena, mark);
+    }
+    assert_true(ta_get_arena_stats(arena, &stats));
+    assert_equal(stats.blocks, blocks);
+
+    // Nothing carved after a mark is reused while it lives.
+    mark = ta_mark(arena);
+    void *kept = ta_alloc(arena, 200);
+    assert_equal(ta_get_size(ta_alloc(arena, 200)), 200);
+    ta_set_parent(kept, str);
+    ta_release_to(arena, mark);
+    assert_true((char *)ta_alloc(arena, 200) != (char *)kept);
+    assert_str_equal(str, "before");
+
+    ta_free(tactx);
+}
+
+TEST(test_ta_reset)
+{
+    struct ta_arena_stats stats;
+    void *tactx = ta_alloc(NULL, 0);
+    void *arena = ta_arena_new(tactx, 4096);
+
+    // Every cycle carves the same memory again.
+    char *first = NULL;
+    size_t blocks = 0;
+    for (size_t cycle = 0; cycle < 3; ++cycle) {
+        char *ptr = ta_strdup(arena, "first");
+        for (size_t i = 0; i < 100; ++i)
+            assert_equal(ta_get_size(ta_alloc(arena, 200)), 200);
+        assert_equal(ta_get_size(ta_alloc(arena, 2000)), 2000);
+        assert_true(ta_get_arena_stats(arena, &stats));
+
+        if (cycle == 0) {
+            first = ptr;
+            blocks = stats.blocks;
+        }
+        assert_equal(ptr, first);
+        assert_equal(stats.blocks, blocks);
+
+        ta_reset(arena, SIZE_MAX);
+        assert_null(ta_get_child(arena));
+        assert_true(ta_get_arena_stats(arena, &stats));
+        assert_equal(stats.blocks, blocks - 1);
+    }
+
+    // The blocks kept are capped, the first block is always kept.
+    ta_reset(arena, 4096);
+    assert_true(ta_get_arena_stats(arena, &stats));
+    assert_equal(stats.blocks, 2);
+    ta_reset(arena, 0);
+    assert_true(ta_get_arena_stats(arena, &stats));
+    assert_equal(stats.blocks, 1);
+
+    // Trimming releases the blocks kept.
+    for (size_t i = 0; i < 100; ++i)
+        assert_equal(ta_get_size(ta_alloc(arena, 200)), 200);
+    ta_reset(arena, SIZE_MAX);
+    assert_true(ta_trim(arena) >= (blocks - 2) * 4096);
+    assert_true(ta_get_arena_stats(arena, &stats));
+    assert_equal(stats.blocks, 1);
+
+    // Chunks moved out of the arena are not carved over.
+    for (size_t i = 0; i < 50; ++i)
+        assert_equal(ta_get_size(ta_alloc(arena, 200)), 200);
+    char *moved = ta_strdup(arena, "moved");
+    ta_set_parent(moved, tactx);
+    for (size_t i = 0; i < 50; ++i)
+        assert_equal(ta_get_size(ta_alloc(arena, 200)), 200);
+    ta_reset(arena, SIZE_MAX);
+    ta_trim(arena);
+    for (size_t i = 0; i < 100; ++i)
+        memset(ta_alloc(arena, 200), 0xFF, 200);
+    assert_str_equal(moved, "moved");
+    ta_free(moved);
+
+    // Other chunks just lose their children.
+    for (size_t i = 0; i < 10; ++i)
+        assert_equal(ta_get_size(ta_alloc(tactx, 100)), 100);
+    ta_reset(tactx, SIZE_MAX);
+    assert_null(ta_get_child(tactx));
+
+    ta_free(tactx);
+}
+
+TEST(test_ta_trim)
+{
+    struct ta_arena_stats stats;
+    void *tactx = ta_alloc(NULL, 0);
+    assert_equal(ta_trim(tactx), 0);
+
+    // Arenas keep the blocks their chunks live in.
+    void *arena = ta_arena_new(tactx, 4096);
+    char *first = ta_strdup(arena, "first");
+    for (size_t i = 0; i < 100; ++i)
+        assert_equal(ta_get_size(ta_alloc(arena, 200)), 200);
+    assert_equal(ta_get_size(ta_alloc(arena, 2000)), 2000);
+    assert_true(ta_get_arena_stats(arena, &stats));
+    size_t blocks = stats.blocks;
+    assert_true(blocks > 2);
+
+    ta_trim(tactx);
+    assert_true(ta_get_arena_stats(arena, &stats));
+    assert_equal(stats.blocks, blocks);
+    assert_str_equal(first, "first");
+
+    // Once they are gone, only the first block is left and carving restarts in it.
+    ta_free_children(arena);
+    assert_true(ta_trim(tactx) >= (blocks - 2) * 4096);
+    assert_true(ta_get_arena_stats(arena, &stats));
+    assert_equal(stats.blocks, 1);
+
+    for (size_t i = 0; i < 100; ++i) {
+        char *ptr = (char *)ta_zalloc(arena, 200);
+        assert_equal(ptr[199], 0);
+    }
+    assert_true(ta_get_arena_stats(arena, &stats));
+    assert_true(stats.blocks > 1);
+    ta_free(arena);
+
+#ifndef _WIN32
+    // Prefaulted arenas stay resident when an ancestor is trimmed.
+    size_t size = (size_t)1 << 20;
+    arena = ta_arena_map(tactx, size, TA_ARENA_PREFAULT);
+    char *ptr = (char *)ta_alloc(arena, 1000);
+    memset(ptr, 1, 1000);
+    assert_true(ta_get_arena_stats(arena, &stats));
+    size_t resident = stats.huge_bytes + stats.regular_bytes;
+    assert_equal(ta_trim(tactx), 0);
+    assert_true(ta_get_arena_stats(arena, &stats));
+    assert_equal(stats.huge_bytes + stats.regular_bytes, resident);
+#ifdef __linux__
+    assert_true(resident >= size / 2);
+#endif
+
+    // Trimmed on their own, their untouched pages go back and read as zeros again.
+    assert_true(ta_trim(arena) >= size / 2);
+    assert_equal(ta_trim(arena), 0);
+    assert_equal(ptr[999], 1);
+
+    ptr = (char *)ta_zalloc(arena, 100000);
+    assert_equal(ptr[99999], 0);
+    memset(ptr, 1, 100000);
+    ta_free(ptr);
+    assert_true(ta_trim(arena) >= 90000);
+
+    // Other mapped arenas are trimmed with their ancestors.
+    void *lazy = ta_arena_map(tactx, size, 0);
+    ptr = (char *)ta_alloc(lazy, 100000);
+    memset(ptr, 1, 100000);
+    ta_free(ptr);
+    assert_true(ta_trim(tactx) >= 90000);
+#endif
+
+    // Chunks cached or in slabs go back with the process-wide trim.
+    for (size_t i = 0; i < 64; ++i)
+        ta_free(ta_alloc(NULL, 600));
+    void *arr[4096];
+    for (size_t i = 0; i < 4096; ++i)
+        arr[i] = ta_alloc(tactx, 48);
+    for (size_t i = 0; i < 4096; ++i)
+        ta_free(arr[i]);
+
+    size_t released = ta_trim_all();
+#if defined(TA_CACHE) && TA_CACHE
+    assert_true(released >= 600);
+#endif
+#if defined(TA_SLAB) && TA_SLAB
+    assert_true(released >= 4096 * 48);
+#endif
+    (void)released;
+
+    struct ta_cache_stats cache;
+    ta_get_cache_stats(&cache);
+    assert_equal(cache.blocks, 0);
+    assert_equal(ta_get_size(ta_alloc(tactx, 48)), 48);
+
+    ta_free(tactx);
+}
+
 int main(void)
 {
     struct {
@@ -1479,14 +3668,22 @@ int main(void)
         { "ta_get_parent", test_ta_get_parent },
         { "ta_get_size", test_ta_get_size },
         { "ta_get_child", test_ta_get_child },
+        { "ta_get_child_count", test_ta_get_child_count },
+        { "ta_get_child_at", test_ta_get_child_at },
         { "ta_get_next", test_ta_get_next },
         { "ta_get_prev", test_ta_get_prev },
+        { "ta_inline", test_ta_inline },
         { "ta_has_parent", test_ta_has_parent },
         { "ta_has_child", test_ta_has_child },
+        { "ta_ancestry", test_ta_ancestry },
         { "ta_move_children", test_ta_move_children },
+        { "ta_links", test_ta_links },
+        { "ta_wide", test_ta_wide },
         { "ta_alloc", test_ta_alloc },
         { "ta_zalloc", test_ta_zalloc },
+        { "ta_alloc_many", test_ta_alloc_many },
         { "ta_realloc", test_ta_realloc },
+        { "ta_realloc_huge", test_ta_realloc_huge },
         { "ta_memdup", test_ta_memdup },
         { "ta_assign", test_ta_assign },
         { "ta_alloc_array", test_ta_alloc_array },
@@ -1504,8 +3701,36 @@ int main(void)
         { "ta_asprintf", test_ta_asprintf },
         { "ta_asprintf_append", test_ta_asprintf_append },
         { "ta_asprintf_append_buffer", test_ta_asprintf_append_buffer },
+#if !defined(TA_DESTRUCTORS) || TA_DESTRUCTORS
         { "ta_destructor", test_ta_destructor },
+        { "ta_destructor_realloc", test_ta_destructor_realloc },
+        { "ta_destructor_order", test_ta_destructor_order },
+        { "ta_destructor_subtree", test_ta_destructor_subtree },
+#else
+        { "ta_no_destructors", test_ta_no_destructors },
+#endif
+        { "ta_names", test_ta_names },
+        { "ta_free_deep", test_ta_free_deep },
+#if defined(TA_OUTLINE) && TA_OUTLINE
+        { "ta_outline", test_ta_outline },
+#endif
         { "ta_foreach", test_ta_foreach },
+        { "ta_walk", test_ta_walk },
+        { "ta_allocator", test_ta_allocator },
+        { "ta_arena", test_ta_arena },
+        { "ta_pool", test_ta_pool },
+        { "ta_context_from_buffer", test_ta_context_from_buffer },
+#ifndef _WIN32
+        { "ta_arena_map", test_ta_arena_map },
+#endif
+        { "ta_aligned", test_ta_aligned },
+        { "ta_cache", test_ta_cache },
+        { "ta_mark", test_ta_mark },
+        { "ta_reset", test_ta_reset },
+        { "ta_trim", test_ta_trim },
+#if defined(TA_SLAB) && TA_SLAB
+        { "ta_slab", test_ta_slab },
+#endif
     };
 
     for (size_t i = 0, n = sizeof(tests) / sizeof(tests[0]); i < n; ++i) {